@@ -16,7 +16,7 @@ typedef struct alias {
 static alias_t *aliases = NULL;
 static int alias_count = 0;
 
-static char *alias_expand_recursive(const char *line, int depth);
+static char *alias_expand_recursive(arena_t *a, const char *line, int depth);
 
 void aliases_init(void) {
     // Could load from ~/.minishell_aliases if desired
@@ -102,11 +102,13 @@ void alias_print(const char *name) {
     }
 }
 
-char *alias_expand(const char *line) {
-    return alias_expand_recursive(line, 0);
+// The line with its first word's alias expanded (recursively), in a;
+// NULL if there is nothing to expand.
+char *alias_expand(arena_t *a, const char *line) {
+    return alias_expand_recursive(a, line, 0);
 }
 
-static char *alias_expand_recursive(const char *line, int depth) {
+static char *alias_expand_recursive(arena_t *a, const char *line, int depth) {
     if (depth > 10) return NULL; // Prevent infinite recursion
     
     if (!line || !*line) return NULL;
@@ -123,30 +125,23 @@ static char *alias_expand_recursive(const char *line, int depth) {
     
     if (end == line) return NULL; // No command found
     
-    size_t cmd_len = end - line;
-    char *cmd_name = xmalloc(cmd_len + 1);
-    memcpy(cmd_name, line, cmd_len);
-    cmd_name[cmd_len] = '\0';
-    
+    char *cmd_name = arena_strndup(a, line, end - line);
     const char *alias_val = alias_get(cmd_name);
-    free(cmd_name);
-    
+
     if (!alias_val) return NULL; // No alias found
     
     // Build expanded line: alias_value + rest of original line
     size_t rest_len = strlen(end);
     size_t val_len = strlen(alias_val);
-    char *expanded = xmalloc(val_len + rest_len + 1);
+    char *expanded = arena_alloc(a, val_len + rest_len + 1);
     memcpy(expanded, alias_val, val_len);
     memcpy(expanded + val_len, end, rest_len);
     expanded[val_len + rest_len] = '\0';
     
     // Check if expanded value itself contains an alias (recursive expansion)
-    char *further_expanded = alias_expand_recursive(expanded, depth + 1);
-    if (further_expanded) {
-        free(expanded);
+    char *further_expanded = alias_expand_recursive(a, expanded, depth + 1);
+    if (further_expanded)
         return further_expanded;
-    }
     
     return expanded;
 }
@@ -0,0 +1,136 @@
+#include "shell.h"
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bump arena.
+//
+// Everything made from one command line lives exactly as long as the
+// line: the alias-expanded text, the command list, argv arrays, words,
+// redirections and glob matches. They all come from one arena, so
+// building them is a pointer bump per object and dropping them is
+// arena_reset(), which takes constant time whatever the line held: the
+// blocks are kept for the next line instead of being handed back to
+// malloc.
+//
+// Blocks double in size (up to ARENA_BLOCK_MAX, or whatever a single
+// request needs), so a line of any length costs a handful of mallocs
+// the first time and none after that.
+
+#define ARENA_BLOCK_MIN  (16 * 1024)
+#define ARENA_BLOCK_MAX  (1024 * 1024)
+#define ARENA_ALIGN      alignof(max_align_t)
+
+struct arena_block {
+    struct arena_block *next;  // older block, or next spare
+    size_t size;               // bytes of data
+    size_t used;
+    alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static arena_block_t *take_block(arena_t *a, size_t need) {
+    // A spare block big enough, if any (there are only a few)
+    for (arena_block_t **pp = &a->spare; *pp; pp = &(*pp)->next) {
+        if ((*pp)->size >= need) {
+            arena_block_t *b = *pp;
+            *pp = b->next;
+            return b;
+        }
+    }
+    size_t size = a->head ? a->head->size * 2 : ARENA_BLOCK_MIN;
+    if (size > ARENA_BLOCK_MAX)
+        size = ARENA_BLOCK_MAX;
+    if (size < need)
+        size = need;
+    arena_block_t *b = xmalloc(sizeof(*b) + size);
+    b->size = size;
+    a->blocks++;
+    return b;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = align_up(size ? size : 1);
+    arena_block_t *b = a->head;
+    if (!b || b->size - b->used < size) {
+        b = take_block(a, size);
+        b->used = 0;
+        b->next = a->head;
+        if (!a->head)
+            a->oldest = b;
+        a->head = b;
+    }
+    void *p = b->data + b->used;
+    b->used += size;
+    a->allocs++;
+    return p;
+}
+
+void *arena_zalloc(arena_t *a, size_t size) {
+    void *p = arena_alloc(a, size);
+    memset(p, 0, size);
+    return p;
+}
+
+// Resizes ptr (old_size bytes, from a). The newest allocation grows in
+// place while its block has room; anything else is copied.
+void *arena_grow(arena_t *a, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr)
+        return arena_alloc(a, new_size);
+    arena_block_t *b = a->head;
+    unsigned char *p = ptr;
+    if (b && p + align_up(old_size ? old_size : 1) == b->data + b->used &&
+        (size_t)(p - b->data) + align_up(new_size) <= b->size) {
+        b->used = (p - b->data) + align_up(new_size);
+        return ptr;
+    }
+    void *np = arena_alloc(a, new_size);
+    memcpy(np, ptr, old_size < new_size ? old_size : new_size);
+    return np;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n) {
+    char *d = arena_alloc(a, n + 1);
+    memcpy(d, s, n);
+    d[n] = '\0';
+    return d;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+// Drops everything allocated from a. The newest (largest) block stays
+// in use; the others move to the spare list in one step.
+void arena_reset(arena_t *a) {
+    arena_block_t *b = a->head;
+    if (!b)
+        return;
+    if (b->next) {
+        a->oldest->next = a->spare;
+        a->spare = b->next;
+        b->next = NULL;
+        a->oldest = b;
+    }
+    b->used = 0;
+    a->allocs = 0;
+}
+
+void arena_free(arena_t *a) {
+    arena_block_t *lists[2] = {a->head, a->spare};
+    for (int i = 0; i < 2; i++) {
+        arena_block_t *b = lists[i];
+        while (b) {
+            arena_block_t *next = b->next;
+            free(b);
+            b = next;
+        }
+    }
+    memset(a, 0, sizeof(*a));
+}
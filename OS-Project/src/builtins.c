@@ -4,12 +4,29 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+// Streams the stream-oriented builtins (echo, cat, grep, ls, pwd) read
+// and write. Unset, they are the process's stdin/stdout; a pipeline stage
+// running on its own thread sets them to its pipe ends.
+static _Thread_local FILE *io_in;
+static _Thread_local FILE *io_out;
+
+static FILE *in_stream(void) {
+    return io_in ? io_in : stdin;
+}
+
+static FILE *out_stream(void) {
+    return io_out ? io_out : stdout;
+}
+
 static int bi_cd(command_t *cmd) {
     const char *dir = NULL;
     if (!cmd->argv[1]) {
@@ -32,7 +49,7 @@ static int bi_pwd(void) {
         perror("pwd");
         return 1;
     }
-    puts(buf);
+    fprintf(out_stream(), "%s\n", buf);
     return 0;
 }
 
@@ -44,6 +61,27 @@ static int bi_exit(shell_state_t *sh, command_t *cmd) {
     return code;
 }
 
+// break [N] / continue [N]: leave N enclosing loops (and go on with the
+// last of them); the loops see sh->breaking as they unwind.
+static int bi_break(shell_state_t *sh, command_t *cmd, bool continuing) {
+    long n = 1;
+    if (cmd->argv[1]) {
+        char *end;
+        n = strtol(cmd->argv[1], &end, 10);
+        if (end == cmd->argv[1] || *end || n < 1) {
+            fprintf(stderr, "%s: %s: loop count out of range\n", cmd->argv[0], cmd->argv[1]);
+            return 1;
+        }
+    }
+    if (sh->loop_depth == 0) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", cmd->argv[0]);
+        return 0;
+    }
+    sh->breaking = n < sh->loop_depth ? (int)n : sh->loop_depth;
+    sh->continuing = continuing;
+    return 0;
+}
+
 static int bi_export(command_t *cmd) {
     for (int i = 1; cmd->argv[i]; i++) {
         char *eq = strchr(cmd->argv[i], '=');
@@ -59,6 +97,9 @@ static int bi_export(command_t *cmd) {
             *eq = '=';
             return 1;
         }
+        if (strcmp(name, "PATH") == 0)
+            pathcache_clear();
+        envblock_invalidate();
         *eq = '=';
     }
     return 0;
@@ -70,11 +111,15 @@ static int bi_unset(command_t *cmd) {
             perror("unsetenv");
             return 1;
         }
+        if (strcmp(cmd->argv[i], "PATH") == 0)
+            pathcache_clear();
+        envblock_invalidate();
     }
     return 0;
 }
 
 static int bi_echo(command_t *cmd) {
+    FILE *out = out_stream();
     int i = 1;
     int newline = 1;
     if (cmd->argv[1] && strcmp(cmd->argv[1], "-n") == 0) {
@@ -84,13 +129,13 @@ static int bi_echo(command_t *cmd) {
     bool first = true;
     for (; cmd->argv[i]; i++) {
         if (!first)
-            fputc(' ', stdout);
-        fputs(cmd->argv[i], stdout);
+            fputc(' ', out);
+        fputs(cmd->argv[i], out);
         first = false;
     }
     if (newline)
-        fputc('\n', stdout);
-    fflush(stdout);
+        fputc('\n', out);
+    fflush(out);
     return 0;
 }
 static int bi_grep(command_t *cmd) {
@@ -99,6 +144,7 @@ static int bi_grep(command_t *cmd) {
         return 1;
     }
     const char *pattern = cmd->argv[1];
+    FILE *out = out_stream();
     int exit_status = 1; // default: no matches
 
     char *line = NULL;
@@ -106,9 +152,10 @@ static int bi_grep(command_t *cmd) {
 
     if (!cmd->argv[2]) {
         // Read from stdin
-        while (getline(&line, &cap, stdin) != -1) {
+        while (getline(&line, &cap, in_stream()) != -1 && !ferror(out) &&
+               !signals_interrupted()) {
             if (strstr(line, pattern)) {
-                fputs(line, stdout);
+                fputs(line, out);
                 exit_status = 0;
             }
         }
@@ -117,12 +164,16 @@ static int bi_grep(command_t *cmd) {
             const char *fname = cmd->argv[i];
             FILE *f = fopen(fname, "r");
             if (!f) {
+                if (errno == EINTR && signals_interrupted())
+                    break;
                 perror(fname);
                 continue;
             }
-            while (getline(&line, &cap, f) != -1) {
+            __fsetlocking(f, FSETLOCKING_BYCALLER);
+            while (getline(&line, &cap, f) != -1 && !ferror(out) &&
+                   !signals_interrupted()) {
                 if (strstr(line, pattern)) {
-                    fputs(line, stdout);
+                    fputs(line, out);
                     exit_status = 0;
                 }
             }
@@ -135,6 +186,7 @@ static int bi_grep(command_t *cmd) {
 }
 
 static int bi_ls(command_t *cmd) {
+    FILE *out = out_stream();
     int status = 0;
     
     // If no arguments, list current directory
@@ -148,7 +200,7 @@ static int bi_ls(command_t *cmd) {
         while ((ent = readdir(dir)) != NULL) {
             if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
                 continue;
-            puts(ent->d_name);
+            fprintf(out, "%s\n", ent->d_name);
         }
         closedir(dir);
         return 0;
@@ -175,21 +227,21 @@ static int bi_ls(command_t *cmd) {
             }
             if (cmd->argv[2]) {
                 // Multiple arguments, show directory name
-                printf("%s:\n", path);
+                fprintf(out, "%s:\n", path);
             }
             struct dirent *ent;
             while ((ent = readdir(dir)) != NULL) {
                 if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
                     continue;
-                puts(ent->d_name);
+                fprintf(out, "%s\n", ent->d_name);
             }
             closedir(dir);
             if (cmd->argv[i + 1]) {
-                printf("\n");
+                fputc('\n', out);
             }
         } else {
             // It's a file - just print the filename
-            puts(path);
+            fprintf(out, "%s\n", path);
         }
     }
     return status;
@@ -425,63 +477,258 @@ static int bi_rm(command_t *cmd) {
     return status;
 }
 
+// Copies what is left of a stream from its descriptor. Nothing is read
+// ahead there: the shell's stdin is unbuffered or synced (input_init()),
+// and fflush() hands a seekable stream's buffer back to the descriptor.
+// Returns 0, or -1 with errno set.
+static int cat_stream(FILE *in, int out_fd) {
+    fflush(in);
+    return copy_fd(fileno(in), out_fd);
+}
+
+// cat copies bytes unchanged (NULs included, no newline added), letting
+// the kernel move them where it can (see fdcopy.c).
 static int bi_cat(command_t *cmd) {
+    FILE *out = out_stream();
+    fflush(out);
+    int out_fd = fileno(out);
+
     if (!cmd->argv[1]) {
         // No arguments - read from stdin
-        char *line = NULL;
-        size_t cap = 0;
-        bool printed_anything = false;
-        while (getline(&line, &cap, stdin) != -1) {
-            fputs(line, stdout);
-            printed_anything = true;
-        }
-        free(line);
-        // Ensure newline at end
-        if (printed_anything) {
-            fputc('\n', stdout);
+        if (cat_stream(in_stream(), out_fd) < 0) {
+            if (errno == EPIPE)
+                return 128 + SIGPIPE;
+            if (errno == EINTR)
+                return 128 + SIGINT;
+            perror("cat");
+            return 1;
         }
-        fflush(stdout);
         return 0;
     }
-    
+
+    struct stat out_st;
+    bool out_file = fstat(out_fd, &out_st) == 0 && S_ISREG(out_st.st_mode);
     int status = 0;
-    bool printed_anything = false;
-    bool last_was_newline = true;
-    
+
     for (int i = 1; cmd->argv[i]; i++) {
         const char *filename = cmd->argv[i];
-        FILE *f = fopen(filename, "r");
-        if (!f) {
+        int fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR && signals_interrupted())
+                return 128 + SIGINT;  // ^C while a FIFO had no writer
             perror(filename);
             status = 1;
             continue;
         }
-        
-        char *line = NULL;
-        size_t cap = 0;
-        while (getline(&line, &cap, f) != -1) {
-            fputs(line, stdout);
-            printed_anything = true;
-            // Check if line ends with newline (getline includes it)
-            size_t len = strlen(line);
-            last_was_newline = (len > 0 && line[len - 1] == '\n');
+
+        // cat f >> f would never reach the end of its input
+        struct stat st;
+        if (out_file && fstat(fd, &st) == 0 &&
+            st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino) {
+            fprintf(stderr, "cat: %s: input file is output file\n", filename);
+            close(fd);
+            status = 1;
+            continue;
+        }
+
+        int r = copy_fd(fd, out_fd);
+        int err = errno;
+        close(fd);
+        if (r < 0) {
+            if (err == EPIPE)
+                return 128 + SIGPIPE;
+            if (err == EINTR)
+                return 128 + SIGINT;
+            errno = err;
+            perror(filename);
+            status = 1;
         }
-        free(line);
-        fclose(f);
     }
-    
-    // Ensure newline at end if we printed anything and last line didn't end with newline
-    if (printed_anything && !last_was_newline) {
-        fputc('\n', stdout);
+    return status;
+}
+
+static int bi_hash(command_t *cmd) {
+    if (!cmd->argv[1]) {
+        pathcache_print();
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "-r") == 0) {
+        pathcache_clear();
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; cmd->argv[i]; i++) {
+        char *path = pathcache_lookup(cmd->argv[i]);
+        if (!path) {
+            fprintf(stderr, "hash: %s: not found\n", cmd->argv[i]);
+            status = 1;
+        }
+        free(path);
     }
-    fflush(stdout);
-    
     return status;
 }
 
+static int bi_loader(command_t *cmd) {
+    const char *sub = cmd->argv[1] ? cmd->argv[1] : "stats";
+    if (strcmp(sub, "stats") == 0) {
+        loader_print_stats();
+        envblock_print_stats();
+        return 0;
+    }
+    if (strcmp(sub, "stack") == 0) {
+        int n = cmd->argv[2] ? atoi(cmd->argv[2]) : 10000;
+        loader_bench_stack(n > 0 ? n : 1);
+        return 0;
+    }
+    if (strcmp(sub, "clear") == 0) {
+        loader_clear_cache();
+        return 0;
+    }
+    if (strcmp(sub, "policy") == 0) {
+        if (!cmd->argv[2])
+            return loader_set_policy(NULL, NULL);
+        if (!cmd->argv[3]) {
+            fprintf(stderr, "loader: usage: loader policy NAME populate,willneed,hugetext|none\n");
+            return 1;
+        }
+        return loader_set_policy(cmd->argv[2], cmd->argv[3]);
+    }
+    if (strcmp(sub, "faults") == 0 && cmd->argv[2]) {
+        loader_set_fault_report(strcmp(cmd->argv[2], "on") == 0);
+        return 0;
+    }
+    fprintf(stderr, "loader: usage: loader [stats|clear|stack [N]|policy [NAME FLAGS]|faults on|off]\n");
+    return 1;
+}
+
+// jobs [-l] [-v]: -l adds every stage's pid and state, -v the live
+// usage of each job's cgroup
+static int bi_jobs(command_t *cmd) {
+    bool long_format = false, usage = false;
+    for (int i = 1; cmd->argv[i]; i++) {
+        if (strcmp(cmd->argv[i], "-l") == 0) {
+            long_format = true;
+        } else if (strcmp(cmd->argv[i], "-v") == 0) {
+            usage = true;
+        } else {
+            fprintf(stderr, "jobs: usage: jobs [-l] [-v]\n");
+            return 1;
+        }
+    }
+    jobs_print(long_format, usage);
+    return 0;
+}
+
+// wait            every background job
+// wait -n         the next one to finish
+// wait %N|PID...  those jobs
+// Returns the (last) waited job's status.
+static int bi_wait(command_t *cmd) {
+    if (!cmd->argv[1])
+        return jobs_wait_all();
+    if (strcmp(cmd->argv[1], "-n") == 0)
+        return jobs_wait_next();
+    int status = 0;
+    for (int i = 1; cmd->argv[i]; i++)
+        status = jobs_wait_job(cmd->argv[i]);
+    return status;
+}
+
+// "64K", "1M", "1048576": bytes with an optional K/M/G (1024-based) suffix.
+bool parse_size(const char *s, long *out) {
+    char *end;
+    errno = 0;
+    long n = strtol(s, &end, 10);
+    if (errno || end == s || n < 0)
+        return false;
+    long mult = 1;
+    switch (*end) {
+    case 'k': case 'K': mult = 1024L; end++; break;
+    case 'm': case 'M': mult = 1024L * 1024; end++; break;
+    case 'g': case 'G': mult = 1024L * 1024 * 1024; end++; break;
+    }
+    if (*end || n > LONG_MAX / mult)
+        return false;
+    *out = n * mult;
+    return true;
+}
+
+// set                  show the shell options
+// set pipebuf=SIZE     capacity of pipeline pipes (default: kernel's)
+// set maxjobs=N        background jobs running at once (0: no limit);
+//                      the rest wait in the job queue
+static int bi_set(shell_state_t *sh, command_t *cmd) {
+    if (!cmd->argv[1]) {
+        pipebuf_print(sh);
+        printf("maxjobs=%d\n", sh->max_jobs);
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; cmd->argv[i]; i++) {
+        const char *arg = cmd->argv[i];
+        if (strncmp(arg, "pipebuf=", 8) == 0) {
+            const char *v = arg + 8;
+            long bytes = 0;
+            if (strcmp(v, "default") != 0 && !parse_size(v, &bytes)) {
+                fprintf(stderr, "set: bad size: %s\n", v);
+                status = 1;
+                continue;
+            }
+            status |= pipebuf_set(sh, bytes);
+            continue;
+        }
+        if (strncmp(arg, "maxjobs=", 8) == 0) {
+            char *end;
+            long n = strtol(arg + 8, &end, 10);
+            if (end == arg + 8 || *end || n < 0 || n > INT_MAX) {
+                fprintf(stderr, "set: bad job count: %s\n", arg + 8);
+                status = 1;
+                continue;
+            }
+            sh->max_jobs = (int)n;
+            jobs_dispatch(0);  // a raised limit frees slots right away
+            continue;
+        }
+        fprintf(stderr, "set: usage: set [pipebuf=SIZE|default] [maxjobs=N]\n");
+        status = 1;
+    }
+    return status;
+}
+
+static int bi_exec(command_t *cmd) {
+    // Without a command, exec only makes its redirections permanent, which
+    // execute_commands() already did.
+    if (!cmd->argv[1])
+        return 0;
+    return exec_replace(cmd->argv + 1);
+}
+
+static int bi_zygote(command_t *cmd) {
+    if (cmd->argv[1]) {
+        char *end;
+        errno = 0;
+        long n = strtol(cmd->argv[1], &end, 10);
+        if (end == cmd->argv[1] || *end || errno || n < 0 || n > INT_MAX) {
+            fprintf(stderr, "zygote: invalid pool size: %s\n", cmd->argv[1]);
+            return 1;
+        }
+        zygote_set_size((int)n);
+    }
+    zygote_print_stats();
+    return 0;
+}
+
 bool is_builtin(const char *name) {
     if (!name) return false;
-    return strcmp(name, "cd") == 0 ||
+    return strcmp(name, "[") == 0 ||
+           strcmp(name, "test") == 0 ||
+           strcmp(name, ":") == 0 ||
+           strcmp(name, "true") == 0 ||
+           strcmp(name, "false") == 0 ||
+           strcmp(name, "break") == 0 ||
+           strcmp(name, "continue") == 0 ||
+           strcmp(name, "cd") == 0 ||
            strcmp(name, "pwd") == 0 ||
            strcmp(name, "exit") == 0 ||
            strcmp(name, "export") == 0 ||
@@ -496,11 +743,56 @@ bool is_builtin(const char *name) {
            strcmp(name, "touch") == 0 ||
            strcmp(name, "mkdir") == 0 ||
            strcmp(name, "rm") == 0 ||
-           strcmp(name, "cat") == 0;
+           strcmp(name, "cat") == 0 ||
+           strcmp(name, "hash") == 0 ||
+           strcmp(name, "zygote") == 0 ||
+           strcmp(name, "exec") == 0 ||
+           strcmp(name, "loader") == 0 ||
+           strcmp(name, "set") == 0 ||
+           strcmp(name, "wait") == 0 ||
+           strcmp(name, "parallel") == 0 ||
+           strcmp(name, "cgroup") == 0 ||
+           strcmp(name, "source") == 0 ||
+           strcmp(name, ".") == 0;
+}
+
+// Builtins that only read their input and write their output, touching
+// no shell state, so a pipeline can run them on a thread of the shell.
+bool is_stream_builtin(const char *name) {
+    if (!name) return false;
+    return strcmp(name, "echo") == 0 ||
+           strcmp(name, "cat") == 0 ||
+           strcmp(name, "grep") == 0 ||
+           strcmp(name, "ls") == 0 ||
+           strcmp(name, "pwd") == 0;
+}
+
+// Runs a stream builtin with the calling thread's I/O bound to in/out.
+int run_stream_builtin(command_t *cmd, FILE *in, FILE *out) {
+    io_in = in;
+    io_out = out;
+    shell_state_t dummy = {.last_status = 0, .running = true};
+    int status = run_builtin(&dummy, cmd);
+    // Output failed; a reader that went away is reported the way a child
+    // killed by SIGPIPE would be.
+    if (fflush(out) == EOF || ferror(out))
+        status = (errno == EPIPE) ? 128 + SIGPIPE : 1;
+    io_in = NULL;
+    io_out = NULL;
+    return status;
 }
 
 int run_builtin(shell_state_t *sh, command_t *cmd) {
     const char *name = cmd->argv[0];
+    // Loop conditions and bodies first: these may run millions of times
+    if (strcmp(name, "[") == 0 || strcmp(name, "test") == 0)
+        return test_builtin(cmd);
+    if (strcmp(name, ":") == 0 || strcmp(name, "true") == 0)
+        return 0;
+    if (strcmp(name, "false") == 0)
+        return 1;
+    if (strcmp(name, "break") == 0 || strcmp(name, "continue") == 0)
+        return bi_break(sh, cmd, name[0] == 'c');
     if (strcmp(name, "cd") == 0)
         return bi_cd(cmd);
     if (strcmp(name, "pwd") == 0)
@@ -511,10 +803,16 @@ int run_builtin(shell_state_t *sh, command_t *cmd) {
         return bi_export(cmd);
     if (strcmp(name, "unset") == 0)
         return bi_unset(cmd);
-    if (strcmp(name, "jobs") == 0) {
-        jobs_print();
-        return 0;
-    }
+    if (strcmp(name, "jobs") == 0)
+        return bi_jobs(cmd);
+    if (strcmp(name, "wait") == 0)
+        return bi_wait(cmd);
+    if (strcmp(name, "parallel") == 0)
+        return parallel_run(cmd);
+    if (strcmp(name, "cgroup") == 0)
+        return cgroup_builtin(cmd);
+    if (strcmp(name, "source") == 0 || strcmp(name, ".") == 0)
+        return script_source(sh, cmd);
     if (strcmp(name, "echo") == 0)
         return bi_echo(cmd);
     if (strcmp(name, "grep") == 0)
@@ -535,6 +833,16 @@ int run_builtin(shell_state_t *sh, command_t *cmd) {
         return bi_rm(cmd);
     if (strcmp(name, "cat") == 0)
         return bi_cat(cmd);
+    if (strcmp(name, "hash") == 0)
+        return bi_hash(cmd);
+    if (strcmp(name, "zygote") == 0)
+        return bi_zygote(cmd);
+    if (strcmp(name, "exec") == 0)
+        return bi_exec(cmd);
+    if (strcmp(name, "loader") == 0)
+        return bi_loader(cmd);
+    if (strcmp(name, "set") == 0)
+        return bi_set(sh, cmd);
     return 1;
 }
 
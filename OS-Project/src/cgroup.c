@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Per-job cgroups (cgroup v2).
+//
+// With `cgroup on [ROOT]`, the shell makes a directory minishell-PID
+// under ROOT (a delegated subtree; default: the shell's own cgroup) and
+// gives every job that forks a process its own leaf job-N below it.
+// Stages that go straight to the loader are born in the leaf with
+// clone3(CLONE_INTO_CGROUP); where that is unavailable, for builtin
+// stages (a raw clone3() child must not run full libc code: stdio,
+// malloc and atfork state are not reset for it) and for zygote launches,
+// the child writes itself into the leaf's cgroup.procs before it runs
+// anything. Each
+// leaf gets the default limits (cgroup limit ...) when it is made and
+// is removed when its job is dropped.
+//
+// Limits need the memory, cpu and pids controllers to be enabled for
+// the subtree; the shell enables whichever it may. Without them (or
+// without a writable cgroup2 mount at all) jobs still run, just
+// without limits, and `jobs -v` shows whatever accounting is there
+// (cpu.stat always is).
+
+#define LIMIT_MEMORY  0
+#define LIMIT_CPU     1
+#define LIMIT_PIDS    2
+#define NLIMITS       3
+
+#define CPU_PERIOD_US 100000
+
+static const char *const limit_names[NLIMITS] = {"memory", "cpu", "pids"};
+static const char *const limit_files[NLIMITS] = {"memory.max", "cpu.max", "pids.max"};
+
+struct cgroup_leaf {
+    int   fd;
+    char *path;
+};
+
+static struct {
+    bool  enabled;
+    int   dirfd;                // <root>/minishell-PID
+    char *path;
+    char  controllers[128];     // enabled for the job leaves
+    char *limits[NLIMITS];      // defaults for new leaves; NULL: untouched
+    char *limit_specs[NLIMITS]; // ... as they were given
+    int   seq;
+    int   clone3;               // 1 works, 0 unsupported, -1 not tried yet
+} cg = {.dirfd = -1, .clone3 = -1};
+
+static int write_at(int dirfd, const char *name, const char *value) {
+    int fd = openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t len = (ssize_t)strlen(value);
+    ssize_t n = write(fd, value, len);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return n == len ? 0 : -1;
+}
+
+static bool read_at(int dirfd, const char *name, char *buf, size_t len) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return false;
+    buf[n] = '\0';
+    if (n > 0 && buf[n - 1] == '\n')
+        buf[n - 1] = '\0';
+    return true;
+}
+
+// The shell's own cgroup: the cgroup2 mount point plus the "0::" path.
+static bool default_root(char *buf, size_t len) {
+    char mnt[256] = "";
+    char line[512];
+    FILE *f = fopen("/proc/self/mounts", "r");
+    if (!f)
+        return false;
+    while (fgets(line, sizeof(line), f)) {
+        char dev[64], dir[256], type[32];
+        if (sscanf(line, "%63s %255s %31s", dev, dir, type) == 3 &&
+            strcmp(type, "cgroup2") == 0) {
+            strcpy(mnt, dir);
+            break;
+        }
+    }
+    fclose(f);
+    if (!mnt[0])
+        return false;
+
+    char rel[256] = "/";
+    f = fopen("/proc/self/cgroup", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(rel, sizeof(rel), "%s", line + 3);
+                break;
+            }
+        }
+        fclose(f);
+    }
+    snprintf(buf, len, "%s%s", mnt, strcmp(rel, "/") == 0 ? "" : rel);
+    return true;
+}
+
+// Asks root, then our own directory, to pass each controller down.
+// Refusals are expected (no delegation, processes in root) and only
+// mean fewer limits.
+static void enable_controllers(int rootfd) {
+    static const char *const wanted[] = {"+memory", "+cpu", "+pids"};
+    for (int i = 0; i < 3; i++) {
+        write_at(rootfd, "cgroup.subtree_control", wanted[i]);
+        write_at(cg.dirfd, "cgroup.subtree_control", wanted[i]);
+    }
+    if (!read_at(cg.dirfd, "cgroup.subtree_control", cg.controllers, sizeof(cg.controllers)))
+        cg.controllers[0] = '\0';
+}
+
+static void cgroup_disable(void) {
+    if (cg.dirfd >= 0)
+        close(cg.dirfd);
+    cg.dirfd = -1;
+    if (cg.path)
+        rmdir(cg.path);  // fails while a job still has its leaf
+    free(cg.path);
+    cg.path = NULL;
+    cg.enabled = false;
+}
+
+static int cgroup_enable(const char *root) {
+    char def[512];
+    if (!root) {
+        if (!default_root(def, sizeof(def))) {
+            fprintf(stderr, "cgroup: no cgroup2 filesystem mounted\n");
+            return 1;
+        }
+        root = def;
+    }
+    int rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootfd < 0) {
+        perror(root);
+        return 1;
+    }
+    if (faccessat(rootfd, "cgroup.procs", F_OK, 0) < 0) {
+        fprintf(stderr, "cgroup: %s: not a cgroup2 directory\n", root);
+        close(rootfd);
+        return 1;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "minishell-%d", (int)getpid());
+    if (mkdirat(rootfd, name, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "cgroup: %s/%s: %s\n", root, name, strerror(errno));
+        close(rootfd);
+        return 1;
+    }
+    cgroup_disable();
+    cg.dirfd = openat(rootfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cg.dirfd < 0) {
+        perror(name);
+        close(rootfd);
+        return 1;
+    }
+    size_t len = strlen(root) + strlen(name) + 2;
+    cg.path = xmalloc(len);
+    snprintf(cg.path, len, "%s/%s", root, name);
+    enable_controllers(rootfd);
+    close(rootfd);
+    cg.enabled = true;
+    return 0;
+}
+
+// ---- limits ----
+
+// "memory=512M", "cpu=50%", "pids=100", or "NAME=max": the limit's index
+// and the value for its control file.
+static int parse_limit(const char *spec, char *value, size_t len) {
+    const char *eq = strchr(spec, '=');
+    if (!eq)
+        return -1;
+    int which = -1;
+    for (int i = 0; i < NLIMITS; i++) {
+        if ((size_t)(eq - spec) == strlen(limit_names[i]) &&
+            strncmp(spec, limit_names[i], eq - spec) == 0)
+            which = i;
+    }
+    const char *v = eq + 1;
+    if (which < 0 || !*v)
+        return -1;
+    if (strcmp(v, "max") == 0) {
+        snprintf(value, len, "%s", which == LIMIT_CPU ? "max 100000" : "max");
+        return which;
+    }
+
+    long n;
+    char *end;
+    switch (which) {
+    case LIMIT_MEMORY:
+        if (!parse_size(v, &n))
+            return -1;
+        snprintf(value, len, "%ld", n);
+        break;
+    case LIMIT_CPU:
+        // percent of one CPU: 200% is two CPUs' worth per period
+        n = strtol(v, &end, 10);
+        if (end == v || strcmp(end, "%") != 0 || n < 1 || n > 100000)
+            return -1;
+        snprintf(value, len, "%ld %d", n * (CPU_PERIOD_US / 100), CPU_PERIOD_US);
+        break;
+    case LIMIT_PIDS:
+        n = strtol(v, &end, 10);
+        if (end == v || *end || n < 1)
+            return -1;
+        snprintf(value, len, "%ld", n);
+        break;
+    }
+    return which;
+}
+
+static bool controller_enabled(int which) {
+    const char *name = limit_names[which];
+    size_t len = strlen(name);
+    for (const char *p = cg.controllers; (p = strstr(p, name)); p += len) {
+        if ((p == cg.controllers || p[-1] == ' ') && (p[len] == ' ' || !p[len]))
+            return true;
+    }
+    return false;
+}
+
+static int apply_limit(const cgroup_leaf_t *leaf, int which, const char *value) {
+    if (write_at(leaf->fd, limit_files[which], value) == 0)
+        return 0;
+    if (errno == ENOENT)
+        fprintf(stderr, "cgroup: %s: %s controller not available\n",
+                limit_files[which], limit_names[which]);
+    else
+        fprintf(stderr, "cgroup: %s: %s\n", limit_files[which], strerror(errno));
+    return 1;
+}
+
+// ---- job leaves ----
+
+// A new leaf for one job, with the default limits; NULL when per-job
+// cgroups are off or the leaf can't be made.
+cgroup_leaf_t *cgroup_leaf_create(void) {
+    if (!cg.enabled)
+        return NULL;
+    char name[32];
+    snprintf(name, sizeof(name), "job-%d", ++cg.seq);
+    if (mkdirat(cg.dirfd, name, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "cgroup: %s/%s: %s\n", cg.path, name, strerror(errno));
+        return NULL;
+    }
+    int fd = openat(cg.dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(name);
+        unlinkat(cg.dirfd, name, AT_REMOVEDIR);
+        return NULL;
+    }
+    cgroup_leaf_t *leaf = xmalloc(sizeof(*leaf));
+    leaf->fd = fd;
+    size_t len = strlen(cg.path) + strlen(name) + 2;
+    leaf->path = xmalloc(len);
+    snprintf(leaf->path, len, "%s/%s", cg.path, name);
+    for (int i = 0; i < NLIMITS; i++) {
+        if (cg.limits[i] && controller_enabled(i))
+            apply_limit(leaf, i, cg.limits[i]);
+    }
+    return leaf;
+}
+
+bool cgroup_enabled(void) {
+    return cg.enabled;
+}
+
+int cgroup_leaf_fd(const cgroup_leaf_t *leaf) {
+    return leaf ? leaf->fd : -1;
+}
+
+// The job is gone; so is its leaf, unless something it started lives on.
+void cgroup_leaf_destroy(cgroup_leaf_t *leaf) {
+    if (!leaf)
+        return;
+    close(leaf->fd);
+    rmdir(leaf->path);
+    free(leaf->path);
+    free(leaf);
+}
+
+static long stat_field(const char *text, const char *key) {
+    size_t klen = strlen(key);
+    for (const char *p = text; p && *p; ) {
+        if (strncmp(p, key, klen) == 0 && p[klen] == ' ')
+            return atol(p + klen + 1);
+        p = strchr(p, '\n');
+        if (p)
+            p++;
+    }
+    return -1;
+}
+
+// jobs -v: live usage of a job's leaf.
+void cgroup_leaf_print(const cgroup_leaf_t *leaf) {
+    if (!leaf)
+        return;
+    char buf[1024], max[64];
+    printf("      cgroup %s:", leaf->path);
+    if (read_at(leaf->fd, "memory.current", buf, sizeof(buf))) {
+        printf(" memory %.1f MB", atol(buf) / (1024.0 * 1024.0));
+        if (read_at(leaf->fd, "memory.max", max, sizeof(max)) && strcmp(max, "max") != 0)
+            printf(" (max %.1f MB)", atol(max) / (1024.0 * 1024.0));
+        printf(",");
+    }
+    if (read_at(leaf->fd, "cpu.stat", buf, sizeof(buf))) {
+        long usage = stat_field(buf, "usage_usec");
+        long user = stat_field(buf, "user_usec");
+        long sys = stat_field(buf, "system_usec");
+        long throttled = stat_field(buf, "throttled_usec");
+        printf(" cpu %.3fs (user %.3fs, sys %.3fs", usage / 1e6, user / 1e6, sys / 1e6);
+        if (throttled > 0)
+            printf(", throttled %.3fs", throttled / 1e6);
+        printf(")");
+        long quota, period;
+        if (read_at(leaf->fd, "cpu.max", max, sizeof(max)) &&
+            sscanf(max, "%ld %ld", &quota, &period) == 2 && period > 0)
+            printf(" (max %ld%%)", quota * 100 / period);
+        printf(",");
+    }
+    if (read_at(leaf->fd, "pids.current", buf, sizeof(buf))) {
+        printf(" pids %s", buf);
+        if (read_at(leaf->fd, "pids.max", max, sizeof(max)) && strcmp(max, "max") != 0)
+            printf(" (max %s)", max);
+        printf(",");
+    }
+    if (read_at(leaf->fd, "cgroup.procs", buf, sizeof(buf))) {
+        int n = buf[0] ? 1 : 0;
+        for (const char *p = buf; (p = strchr(p, '\n')); p++)
+            n++;
+        printf(" procs %d", n);
+    }
+    printf("\n");
+}
+
+// ---- launching into a leaf ----
+
+// In a child that is about to run a job's command.
+void cgroup_enter(int cgroup_fd) {
+    if (cgroup_fd >= 0)
+        write_at(cgroup_fd, "cgroup.procs", "0");
+}
+
+// fork(), with the child in the cgroup if cgroup_fd >= 0. loader_only:
+// the child only sets up descriptors and enters the loader, so it may be
+// born in the cgroup by a raw clone3().
+pid_t cgroup_fork(int cgroup_fd, bool loader_only) {
+    if (cgroup_fd >= 0 && loader_only && cg.clone3 != 0) {
+        struct clone_args args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exit_signal = SIGCHLD;
+        args.cgroup = (unsigned)cgroup_fd;
+        long pid = syscall(SYS_clone3, &args, sizeof(args));
+        if (pid >= 0) {
+            cg.clone3 = 1;
+            return (pid_t)pid;
+        }
+        // Old kernel: don't try again. Anything else (the leaf became
+        // unusable, say): fall back this once.
+        if (errno == ENOSYS || errno == E2BIG)
+            cg.clone3 = 0;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+        cgroup_enter(cgroup_fd);
+    return pid;
+}
+
+// ---- builtin ----
+
+static void print_state(void) {
+    if (!cg.enabled) {
+        printf("cgroup: off\n");
+    } else {
+        printf("cgroup: %s\n", cg.path);
+        printf("controllers: %s\n", cg.controllers[0] ? cg.controllers : "none (no limits)");
+        printf("launch: %s\n", cg.clone3 == 0 ? "fork + cgroup.procs" :
+               cg.clone3 == 1 ? "clone3 CLONE_INTO_CGROUP" : "clone3 CLONE_INTO_CGROUP (untried)");
+    }
+    printf("limits:");
+    for (int i = 0; i < NLIMITS; i++)
+        printf(" %s=%s", limit_names[i], cg.limit_specs[i] ? cg.limit_specs[i] : "max");
+    printf("\n");
+}
+
+// cgroup limit [%N|PID] NAME=VALUE...
+static int set_limits(char **argv) {
+    job_t *job = NULL;
+    if (argv[0] && !strchr(argv[0], '=')) {
+        job = jobs_find(argv[0]);
+        if (!job) {
+            fprintf(stderr, "cgroup: %s: no such job\n", argv[0]);
+            return 1;
+        }
+        if (!job_cgroup(job)) {
+            fprintf(stderr, "cgroup: %s: job has no cgroup\n", argv[0]);
+            return 1;
+        }
+        argv++;
+    }
+    if (!argv[0]) {
+        fprintf(stderr, "cgroup: usage: cgroup limit [%%N|PID] memory=SIZE cpu=PCT%% pids=N\n");
+        return 1;
+    }
+    int status = 0;
+    for (; *argv; argv++) {
+        char value[64];
+        int which = parse_limit(*argv, value, sizeof(value));
+        if (which < 0) {
+            fprintf(stderr, "cgroup: bad limit: %s\n", *argv);
+            status = 1;
+            continue;
+        }
+        if (job) {
+            status |= apply_limit(job_cgroup(job), which, value);
+        } else {
+            free(cg.limits[which]);
+            free(cg.limit_specs[which]);
+            bool unlimited = strncmp(value, "max", 3) == 0;
+            cg.limits[which] = unlimited ? NULL : xstrdup(value);
+            cg.limit_specs[which] = unlimited ? NULL : xstrdup(strchr(*argv, '=') + 1);
+            if (cg.enabled && !unlimited && !controller_enabled(which))
+                fprintf(stderr, "cgroup: %s controller not available: %s not enforced\n",
+                        limit_names[which], limit_files[which]);
+        }
+    }
+    return status;
+}
+
+// cgroup                   state and default limits
+// cgroup on [ROOT]         a leaf under ROOT for every new job
+// cgroup off
+// cgroup limit ...         default limits, or a running job's
+int cgroup_builtin(command_t *cmd) {
+    char **argv = cmd->argv;
+    if (!argv[1]) {
+        print_state();
+        return 0;
+    }
+    if (strcmp(argv[1], "on") == 0 && (!argv[2] || !argv[3])) {
+        int status = cgroup_enable(argv[2]);
+        if (status == 0)
+            print_state();
+        return status;
+    }
+    if (strcmp(argv[1], "off") == 0 && !argv[2]) {
+        cgroup_disable();
+        return 0;
+    }
+    if (strcmp(argv[1], "limit") == 0)
+        return set_limits(argv + 2);
+    fprintf(stderr, "cgroup: usage: cgroup [on [ROOT] | off | limit [%%N|PID] NAME=VALUE...]\n");
+    return 1;
+}
+
+void cgroup_cleanup(void) {
+    cgroup_disable();
+    for (int i = 0; i < NLIMITS; i++) {
+        free(cg.limits[i]);
+        free(cg.limit_specs[i]);
+        cg.limits[i] = cg.limit_specs[i] = NULL;
+    }
+}
@@ -48,7 +48,9 @@ static int completion_compare(const void *a, const void *b) {
 static void get_builtin_completions(const char *prefix, completion_list_t *list) {
     const char *builtins[] = {
         "cd", "pwd", "exit", "export", "unset", "jobs", "echo", "grep", "ls",
-        "alias", "unalias", "history", "touch", "mkdir", "rm", "cat", NULL
+        "alias", "unalias", "history", "touch", "mkdir", "rm", "cat", "hash", "zygote", "exec", "loader",
+        "set", "wait", "parallel", "cgroup", "source", "test", "true", "false", "break", "continue",
+        NULL
     };
     
     size_t prefix_len = strlen(prefix);
@@ -242,6 +244,14 @@ int complete_input(const char *line, size_t cursor, char **completion, int *list
                 fputs(" - Remove files/directories", stdout);
             } else if (strcmp(list.items[i], "cat") == 0) {
                 fputs(" - Display file contents", stdout);
+            } else if (strcmp(list.items[i], "hash") == 0) {
+                fputs(" - Show/clear command location cache", stdout);
+            } else if (strcmp(list.items[i], "zygote") == 0) {
+                fputs(" - Pre-forked launch pool size and stats", stdout);
+            } else if (strcmp(list.items[i], "exec") == 0) {
+                fputs(" - Replace the shell with a command", stdout);
+            } else if (strcmp(list.items[i], "loader") == 0) {
+                fputs(" - ELF loader cache statistics", stdout);
             }
             fputc('\r', stdout);
             fputc('\n', stdout);
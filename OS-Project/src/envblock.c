@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pre-packed environment.
+//
+// Every launch hands the new program a copy of the shell's environment.
+// Instead of walking environ with strlen() and copying the strings one
+// at a time in each child, the shell keeps them packed back to back in
+// one block together with each string's offset. The loader copies the
+// block onto the new stack with a single memcpy() and derives envp[]
+// from the offsets. The block is rebuilt only after export/unset (or if
+// something else replaced environ).
+
+extern char **environ;
+
+static env_block_t block;
+static bool   dirty = true;
+static char **built_from = NULL;  // environ when the block was built
+static long   rebuilds = 0;
+
+static void rebuild(void) {
+    int count = 0;
+    size_t len = 0;
+    for (char **e = environ; e && *e; e++) {
+        len += strlen(*e) + 1;
+        count++;
+    }
+
+    free(block.strings);
+    free(block.offsets);
+    block.strings = xmalloc(len ? len : 1);
+    block.offsets = xmalloc((count ? count : 1) * sizeof(size_t));
+    block.len = len;
+    block.count = count;
+
+    char *p = block.strings;
+    for (int i = 0; i < count; i++) {
+        size_t n = strlen(environ[i]) + 1;
+        block.offsets[i] = p - block.strings;
+        memcpy(p, environ[i], n);
+        p += n;
+    }
+
+    built_from = environ;
+    dirty = false;
+    rebuilds++;
+}
+
+const env_block_t *envblock_get(void) {
+    if (dirty || environ != built_from)
+        rebuild();
+    return &block;
+}
+
+void envblock_invalidate(void) {
+    dirty = true;
+}
+
+void envblock_print_stats(void) {
+    const env_block_t *env = envblock_get();
+    printf("env: %d variables, %zu bytes packed, %ld rebuilds\n",
+           env->count, env->len, rebuilds);
+}
+
+void envblock_cleanup(void) {
+    free(block.strings);
+    free(block.offsets);
+    block.strings = NULL;
+    block.offsets = NULL;
+    block.len = 0;
+    block.count = 0;
+    dirty = true;
+}
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Child event loop.
+//
+// Every process the shell starts is watched through a pidfd registered
+// with one epoll instance. A pidfd becomes readable when its process
+// exits, so the loop reaps exactly that process with
+// waitid(P_PIDFD, ...) and hands the status to jobs.c right away,
+// whether the shell is waiting for a foreground job, sitting at the
+// prompt, or reading keys (input.c polls the epoll descriptor next to
+// stdin). Nothing ever waits on -1, so the zygotes and other children
+// the shell manages itself are never reaped by accident.
+//
+// Kernels without pidfd_open() (before 5.3) fall back to checking the
+// watched processes with wait4(WNOHANG) every EVENTS_POLL_MS.
+
+#define EVENTS_MAX      16
+#define EVENTS_POLL_MS  10
+
+static int epfd = -1;
+
+// Processes watched without a pidfd
+static job_proc_t **polled = NULL;
+static int npolled = 0;
+static int polled_cap = 0;
+
+void events_init(void) {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        perror("epoll_create1");
+}
+
+int events_fd(void) {
+    return epfd;
+}
+
+static int status_from_siginfo(const siginfo_t *si) {
+    if (si->si_code == CLD_EXITED)
+        return si->si_status;
+    return 128 + si->si_status;  // CLD_KILLED, CLD_DUMPED
+}
+
+static int status_from_wait(int wstatus) {
+    if (WIFEXITED(wstatus))
+        return WEXITSTATUS(wstatus);
+    if (WIFSIGNALED(wstatus))
+        return 128 + WTERMSIG(wstatus);
+    return 0;
+}
+
+void events_watch(job_proc_t *p) {
+    p->pidfd = -1;
+    if (epfd >= 0) {
+        int fd = (int)syscall(SYS_pidfd_open, p->pid, 0);
+        if (fd >= 0) {
+            struct epoll_event ev = {.events = EPOLLIN, .data.ptr = p};
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+                p->pidfd = fd;
+                return;
+            }
+            perror("epoll_ctl");
+            close(fd);
+        }
+    }
+    if (npolled == polled_cap) {
+        polled_cap = polled_cap ? polled_cap * 2 : 8;
+        polled = realloc(polled, polled_cap * sizeof(*polled));
+        if (!polled) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    polled[npolled++] = p;
+}
+
+// Forgets a process that will never be reaped here (e.g. the shell is
+// about to drop its job table).
+void events_unwatch(job_proc_t *p) {
+    if (p->pidfd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, p->pidfd, NULL);
+        close(p->pidfd);
+        p->pidfd = -1;
+        return;
+    }
+    for (int i = 0; i < npolled; i++) {
+        if (polled[i] == p) {
+            polled[i] = polled[--npolled];
+            return;
+        }
+    }
+}
+
+// Reaps a process whose pidfd is readable. Returns true if it had exited.
+static bool reap_pidfd(job_proc_t *p) {
+    siginfo_t si;
+    struct rusage ru;
+    memset(&si, 0, sizeof(si));
+    // glibc's waitid() has no rusage argument; the system call does
+    if (syscall(SYS_waitid, P_PIDFD, p->pidfd, &si, WEXITED | WNOHANG, &ru) < 0) {
+        if (errno == EINTR)
+            return false;
+        perror("waitid");
+        si.si_pid = p->pid;  // can't be waited for: don't wait forever
+        si.si_code = CLD_EXITED;
+        si.si_status = 127;
+        memset(&ru, 0, sizeof(ru));
+    } else if (si.si_pid == 0) {
+        return false;
+    }
+    int st = status_from_siginfo(&si);
+    events_unwatch(p);
+    jobs_proc_exited(p, st, &ru);
+    return true;
+}
+
+static int reap_polled(void) {
+    int n = 0;
+    for (int i = 0; i < npolled; ) {
+        job_proc_t *p = polled[i];
+        int wstatus;
+        struct rusage ru;
+        pid_t w = wait4(p->pid, &wstatus, WNOHANG, &ru);
+        if (w == 0 || (w < 0 && errno == EINTR)) {
+            i++;
+            continue;
+        }
+        if (w < 0) {
+            perror("wait4");
+            wstatus = 127 << 8;
+            memset(&ru, 0, sizeof(ru));
+        }
+        polled[i] = polled[--npolled];
+        jobs_proc_exited(p, status_from_wait(wstatus), &ru);
+        n++;
+    }
+    return n;
+}
+
+// Waits up to timeout_ms (-1: until something happens) and reaps every
+// watched process that has exited. Returns how many were reaped, or -1
+// with errno set (EINTR when a signal arrived).
+int events_dispatch(int timeout_ms) {
+    int reaped = reap_polled();
+    if (reaped > 0)
+        timeout_ms = 0;
+    else if (npolled > 0 && (timeout_ms < 0 || timeout_ms > EVENTS_POLL_MS))
+        timeout_ms = EVENTS_POLL_MS;
+    if (epfd < 0) {
+        if (timeout_ms > 0)
+            usleep(timeout_ms * 1000);
+        return reaped + reap_polled();
+    }
+
+    struct epoll_event evs[EVENTS_MAX];
+    int n = epoll_wait(epfd, evs, EVENTS_MAX, timeout_ms);
+    if (n < 0) {
+        if (reaped > 0)
+            return reaped;
+        if (errno != EINTR)
+            perror("epoll_wait");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (reap_pidfd(evs[i].data.ptr))
+            reaped++;
+    }
+    return reaped + reap_polled();
+}
+
+void events_cleanup(void) {
+    free(polled);
+    polled = NULL;
+    npolled = polled_cap = 0;
+    if (epfd >= 0)
+        close(epfd);
+    epfd = -1;
+}
@@ -3,39 +3,19 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-int loader_run_elf(const char *path, char *const argv[], char *const envp[]);
-
-static char *find_in_path(const char *name) {
-    if (strchr(name, '/'))
-        return xstrdup(name);
-    const char *path = getenv("PATH");
-    if (!path)
-        path = "/bin:/usr/bin";
-    char *p = xstrdup(path);
-    char *save = NULL;
-    for (char *dir = strtok_r(p, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
-        size_t len = strlen(dir) + 1 + strlen(name) + 1;
-        char *full = xmalloc(len);
-        snprintf(full, len, "%s/%s", dir, name);
-        if (access(full, X_OK) == 0) {
-            free(p);
-            return full;
-        }
-        free(full);
-    }
-    free(p);
-    return NULL;
-}
-
-static int setup_redirs(redir_t *r) {
+int setup_redirs(redir_t *r) {
     for (; r; r = r->next) {
         int fd;
         if (r->type == REDIR_IN) {
@@ -79,18 +59,55 @@ static int setup_redirs(redir_t *r) {
     return 0;
 }
 
-static int launch_process(command_t *cmd, int in_fd, int out_fd, pid_t pgid, int is_first, int is_background) {
-    // Expand glob patterns for this command
-    char **expanded_argv = expand_glob_patterns(cmd->argv);
-    bool was_expanded = (expanded_argv != cmd->argv);
-    
-    pid_t pid = fork();
+// Everything a child needs to start a command, computed in the parent.
+// Once forked, the child only dup2()s descriptors and hands these
+// pointers to the builtin or the loader; it never allocates.
+//
+// A clone(CLONE_VM|CLONE_VFORK) launch is not usable here: without
+// execve() the child never gets a fresh address space, and the loader
+// would map the new image over the shell's own memory with MAP_FIXED.
+typedef struct launch {
+    char **argv;        // final argv, owned by the command
+    bool   builtin;
+    char  *path;        // resolved external path, NULL if not found
+    const elf_image_t *image;  // cached headers/mapping plan, if valid
+    const env_block_t *env;    // packed environment
+} launch_t;
+
+static void launch_prepare(launch_t *l, command_t *cmd) {
+    l->argv = cmd->argv;
+    l->builtin = is_builtin(l->argv[0]);
+    // Resolve external commands in the parent so the hash table remembers them
+    l->path = l->builtin ? NULL : pathcache_lookup(l->argv[0]);
+    l->image = l->path ? loader_prepare(l->path) : NULL;
+    l->env = l->builtin ? NULL : envblock_get();
+}
+
+static void launch_release(launch_t *l) {
+    free(l->path);
+}
+
+static int launch_process(command_t *cmd, int in_fd, int out_fd, pid_t pgid, int is_first,
+                          int is_background, int cgroup_fd) {
+    launch_t l;
+    launch_prepare(&l, cmd);
+
+    if (l.path) {
+        pid_t zpid = zygote_launch(l.path, l.image, l.argv, l.env, cmd->redirs,
+                                   in_fd, out_fd, is_first ? 0 : pgid, is_background,
+                                   cgroup_fd);
+        if (zpid > 0) {
+            launch_release(&l);
+            setpgid(zpid, is_first ? zpid : pgid);
+            return zpid;
+        }
+    }
+
+    fflush(stdout); // don't let the child inherit (and re-flush) pending output
+    pid_t pid = cgroup_fork(cgroup_fd, !l.builtin && l.path);
     if (pid < 0) {
         perror("fork");
-        if (was_expanded) {
-            for (int i = 0; expanded_argv[i]; i++) free(expanded_argv[i]);
-            free(expanded_argv);
-        }
+        launch_release(&l);
         return -1;
     }
     if (pid == 0) {
@@ -104,44 +121,38 @@ static int launch_process(command_t *cmd, int in_fd, int out_fd, pid_t pgid, int
         }
         if (setup_redirs(cmd->redirs) < 0)
             _exit(127);
+        // Other stages' pipe ends (and anything else the shell holds)
+        // would otherwise keep pipes open past their writers' exit.
+        close_fds_from(STDERR_FILENO + 1);
 
         setpgid(0, pgid ? pgid : 0);
         if (!is_background)
             tcsetpgrp(STDIN_FILENO, getpid());
+        signals_reset();
 
-        if (is_builtin(expanded_argv[0])) {
-            command_t temp_cmd = *cmd;
-            temp_cmd.argv = expanded_argv;
+        if (l.builtin) {
+            // The shell's epoll descriptor went with the others above; a
+            // builtin that starts processes (parallel) needs its own.
+            events_init();
+            // Whatever the shell had read ahead on stdin (the rest of a
+            // script piped to it) is the shell's, not this command's.
+            __fpurge(stdin);
             shell_state_t dummy = {.last_status = 0, .running = true};
-            int st = run_builtin(&dummy, &temp_cmd);
-            if (was_expanded) {
-                for (int i = 0; expanded_argv[i]; i++) free(expanded_argv[i]);
-                free(expanded_argv);
-            }
+            int st = run_builtin(&dummy, cmd);
             exit(st); // use exit() so stdio buffers are flushed for pipelines
         }
 
-        char *path = find_in_path(expanded_argv[0]);
-        if (!path) {
-            fprintf(stderr, "%s: command not found\n", expanded_argv[0]);
-            if (was_expanded) {
-                for (int i = 0; expanded_argv[i]; i++) free(expanded_argv[i]);
-                free(expanded_argv);
-            }
+        if (!l.path) {
+            fprintf(stderr, "%s: command not found\n", l.argv[0]);
             _exit(127);
         }
-        extern char **environ;
-        loader_run_elf(path, expanded_argv, environ);
-        if (was_expanded) {
-            for (int i = 0; expanded_argv[i]; i++) free(expanded_argv[i]);
-            free(expanded_argv);
-        }
+        if (l.image)
+            loader_exec_image(l.image, l.path, l.argv, l.env);
+        else
+            loader_run_elf(l.path, l.argv, l.env);
         _exit(127);
     } else {
-        if (was_expanded) {
-            for (int i = 0; expanded_argv[i]; i++) free(expanded_argv[i]);
-            free(expanded_argv);
-        }
+        launch_release(&l);
         if (is_first)
             setpgid(pid, pid);
         else
@@ -150,97 +161,601 @@ static int launch_process(command_t *cmd, int in_fd, int out_fd, pid_t pgid, int
     }
 }
 
-static int execute_pipeline(shell_state_t *sh, command_t *cmd) {
-    (void)sh;
+// Starts cmd as a background process (own process group, no terminal)
+// with the given stdin/stdout, the same way a pipeline stage starts,
+// in the cgroup cgroup_fd if it is not -1.
+pid_t exec_launch(command_t *cmd, int in_fd, int out_fd, int cgroup_fd) {
+    return launch_process(cmd, in_fd, out_fd, 0, true, true, cgroup_fd);
+}
+
+// A stream builtin stage run on a thread of the shell instead of in a
+// forked child. The thread owns in_fd/out_fd and closes them when it is
+// done, which is what lets the next stage see EOF.
+typedef struct stage_thread {
+    pthread_t  tid;
+    command_t *cmd;
+    int        in_fd;
+    int        out_fd;
+    int        status;
+    bool       started;
+    bool       done;         // set by the thread as it finishes
+    sem_t     *finished;     // posted by the thread as it finishes
+    timing_stage_t *timing;  // under `time`
+} stage_thread_t;
+
+static bool pipe_threads_enabled(void) {
+    const char *env = getenv("MINISHELL_PIPE_THREADS");
+    return !env || strcmp(env, "0") != 0;
+}
+
+static bool stage_runs_on_thread(command_t *c, int in_fd) {
+    if (c->background || !pipe_threads_enabled() || !is_stream_builtin(c->argv[0]))
+        return false;
+    // Reading the shell's own stdin (the terminal, usually) from a thread
+    // would happen outside the foreground process group; leave that to
+    // a child.
+    bool reads_stdin = (strcmp(c->argv[0], "cat") == 0 && !c->argv[1]) ||
+                       (strcmp(c->argv[0], "grep") == 0 && c->argv[1] && !c->argv[2]);
+    if (reads_stdin && in_fd == STDIN_FILENO) {
+        for (redir_t *r = c->redirs; r; r = r->next) {
+            if (r->type == REDIR_IN)
+                return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Applies a thread stage's redirections to its own descriptors instead
+// of the shell's 0 and 1, in the same order setup_redirs() would.
+int redirect_stage_fds(redir_t *r, int *in_fd, int *out_fd) {
+    for (; r; r = r->next) {
+        int fd;
+        if (r->type == REDIR_IN)
+            fd = open(r->filename, O_RDONLY | O_CLOEXEC);
+        else
+            fd = open(r->filename, O_WRONLY | O_CREAT | O_CLOEXEC |
+                      (r->type == REDIR_APPEND ? O_APPEND : O_TRUNC), 0666);
+        if (fd < 0) {
+            if (errno != EINTR || !signals_interrupted())
+                perror(r->filename);
+            return -1;
+        }
+        int *slot = (r->type == REDIR_IN) ? in_fd : out_fd;
+        if (*slot > STDERR_FILENO)
+            close(*slot);
+        *slot = fd;
+    }
+    return 0;
+}
+
+static void close_stage_fds(stage_thread_t *t) {
+    if (t->in_fd > STDERR_FILENO)
+        close(t->in_fd);
+    if (t->out_fd > STDERR_FILENO)
+        close(t->out_fd);
+}
+
+static void stage_thread_run(stage_thread_t *t) {
+    FILE *in = (t->in_fd == STDIN_FILENO) ? stdin : fdopen(t->in_fd, "r");
+    FILE *out = (t->out_fd == STDOUT_FILENO) ? stdout : fdopen(t->out_fd, "w");
+    if (!in || !out) {
+        perror("fdopen");
+        if (in && in != stdin)
+            fclose(in);
+        else if (t->in_fd > STDERR_FILENO)
+            close(t->in_fd);
+        if (out && out != stdout)
+            fclose(out);
+        else if (t->out_fd > STDERR_FILENO)
+            close(t->out_fd);
+        t->status = 1;
+        return;
+    }
+    // The pipe streams belong to this thread alone; skip stdio's locking
+    if (in != stdin)
+        __fsetlocking(in, FSETLOCKING_BYCALLER);
+    if (out != stdout)
+        __fsetlocking(out, FSETLOCKING_BYCALLER);
+    t->status = run_stream_builtin(t->cmd, in, out);
+    if (signals_interrupted())
+        t->status = 128 + SIGINT;
+    if (in != stdin)
+        fclose(in);
+    if (out != stdout)
+        fclose(out);
+}
+
+static void *stage_thread_main(void *arg) {
+    stage_thread_t *t = arg;
+    timing_stage_start(t->timing);
+    stage_thread_run(t);
+    timing_stage_stop(t->timing, t->status);
+    __atomic_store_n(&t->done, true, __ATOMIC_RELEASE);
+    sem_post(t->finished);
+    return NULL;
+}
+
+// Starts the thread stages. Every signal but SIGINT is blocked in the
+// threads: job control signals keep going to the main thread, and a
+// write to a pipe whose reader exited fails with EPIPE instead of killing
+// the shell. SIGINT is how a stage is cancelled (join_stage_threads()),
+// so SA_RESTART is off until they are joined.
+static void start_stage_threads(stage_thread_t *threads, int n, sem_t *finished) {
+    if (n == 0)
+        return;
+    sem_init(finished, 0, 0);
+    signals_interruptible(true);
+    sigset_t all, old;
+    sigfillset(&all);
+    sigdelset(&all, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (int i = 0; i < n; i++) {
+        stage_thread_t *t = &threads[i];
+        t->finished = finished;
+        if (redirect_stage_fds(t->cmd->redirs, &t->in_fd, &t->out_fd) < 0) {
+            close_stage_fds(t);
+            t->status = 1;
+            continue;
+        }
+        int err = pthread_create(&t->tid, NULL, stage_thread_main, t);
+        if (err) {
+            errno = err;
+            perror("pthread_create");
+            close_stage_fds(t);
+            t->status = 1;
+            continue;
+        }
+        t->started = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// Stops the thread stages still running: SIGINT ends a blocking call
+// with EINTR, and the stage loops give up once signals_interrupted() is
+// set (which the handler does).
+static void cancel_stage_threads(stage_thread_t *threads, int n) {
+    for (int i = 0; i < n; i++) {
+        if (threads[i].started && !__atomic_load_n(&threads[i].done, __ATOMIC_ACQUIRE))
+            pthread_kill(threads[i].tid, SIGINT);
+    }
+}
+
+// Waits for the thread stages. ^C caught by the shell, or a forked stage
+// of the same job killed by it (cancel), stops the rest.
+static void join_stage_threads(stage_thread_t *threads, int n, sem_t *finished,
+                               bool cancel) {
+    if (n == 0)
+        return;
+    int running = 0;
+    for (int i = 0; i < n; i++)
+        running += threads[i].started;
+    bool cancelled = false;
+    while (running > 0) {
+        if (!cancelled && (cancel || signals_interrupted())) {
+            cancelled = true;
+            cancel_stage_threads(threads, n);
+        }
+        if (sem_wait(finished) == 0)
+            running--;
+    }
+    for (int i = 0; i < n; i++) {
+        if (threads[i].started)
+            pthread_join(threads[i].tid, NULL);
+    }
+    signals_interruptible(false);
+    sem_destroy(finished);
+}
+
+// ---- pipe capacity (set pipebuf=SIZE) ----
+
+// Largest capacity an unprivileged F_SETPIPE_SZ may ask for.
+static long pipe_max_size(void) {
+    long max = 1024 * 1024;
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (f) {
+        if (fscanf(f, "%ld", &max) != 1)
+            max = 1024 * 1024;
+        fclose(f);
+    }
+    return max;
+}
+
+// Gives a new pipe the configured capacity. The kernel rounds it up to a
+// power-of-two number of pages; if it refuses (e.g. the per-user pipe
+// page limit is used up) the pipe keeps its default size.
+static void pipe_apply_size(const shell_state_t *sh, int fd) {
+    if (sh->pipe_size > 0)
+        fcntl(fd, F_SETPIPE_SZ, sh->pipe_size);
+}
+
+// Sets the capacity of pipeline pipes to bytes (0: kernel default),
+// capped at pipe-max-size. A probe pipe shows what the kernel grants,
+// which is what gets stored and reported.
+int pipebuf_set(shell_state_t *sh, long bytes) {
+    int probe[2];
+    if (pipe(probe) < 0) {
+        perror("pipe");
+        return 1;
+    }
+    long def = fcntl(probe[0], F_GETPIPE_SZ);
+    long max = pipe_max_size();
+    long want = bytes > max ? max : bytes;
+    long got = def;
+    if (want > 0) {
+        got = fcntl(probe[0], F_SETPIPE_SZ, (int)want);
+        if (got < 0)
+            perror("pipebuf");
+    }
+    close(probe[0]);
+    close(probe[1]);
+    if (got < 0)
+        return 1;
+
+    sh->pipe_size = (bytes > 0) ? (int)got : 0;
+    if (bytes > 0)
+        printf("pipebuf: requested %ld bytes, got %ld (max %ld)\n", bytes, got, max);
+    else
+        printf("pipebuf: default (%ld bytes)\n", def);
+    return 0;
+}
+
+void pipebuf_print(const shell_state_t *sh) {
+    if (sh->pipe_size > 0)
+        printf("pipebuf=%d\n", sh->pipe_size);
+    else
+        printf("pipebuf=default\n");
+}
+
+// What launching a pipeline's stages produced.
+typedef struct pipeline_launch {
+    stage_thread_t *threads;      // thread stages, not started yet
+    int             nthreads;
+    stage_thread_t *last_thread;  // the last stage, if it runs on a thread
+    pid_t           pgid;         // 0 if no process was forked
+    bool            last_forked;  // the last stage is a process
+    int             status;       // 1 if a pipe or a launch failed
+} pipeline_launch_t;
+
+// Creates the pipes and forks every process stage into job. Thread
+// stages are only set up; the caller starts them.
+static void launch_stages(shell_state_t *sh, command_t *cmd, job_t *job,
+                          pipeline_launch_t *pl) {
     int in_fd = STDIN_FILENO;
-    int status = 0;
     int pipefd[2];
-    pid_t pgid = 0;
-    int num_procs = 0;
+
+    int nstages = 0;
+    for (command_t *c = cmd; c; c = c->next_pipe)
+        nstages++;
+    memset(pl, 0, sizeof(*pl));
+    pl->threads = xmalloc(nstages * sizeof(*pl->threads));
 
     for (command_t *c = cmd; c; c = c->next_pipe) {
         int out_fd = STDOUT_FILENO;
         if (c->next_pipe) {
             if (pipe(pipefd) < 0) {
                 perror("pipe");
-                return 1;
+                pl->status = 1;
+                break;
             }
             out_fd = pipefd[1];
+            pipe_apply_size(sh, out_fd);
         }
 
-        int is_first = (c == cmd);
-        int is_background = c->background;
-
-        pid_t pid = launch_process(c, in_fd, out_fd, pgid, is_first, is_background);
-        if (pid < 0) {
-            status = 1;
+        if (stage_runs_on_thread(c, in_fd)) {
+            // Started once every child has been forked, so no child is
+            // forked while a thread holds a stdio or malloc lock.
+            stage_thread_t *t = &pl->threads[pl->nthreads++];
+            t->cmd = c;
+            t->in_fd = in_fd;
+            t->out_fd = out_fd;
+            t->status = 0;
+            t->started = false;
+            t->timing = timing_stage_add(c, false, "thread", 0);
+            if (!c->next_pipe)
+                pl->last_thread = t;
         } else {
-            num_procs++;
-            if (is_first)
-                pgid = pid;
-        }
+            pid_t pgid = pl->pgid;
+            pid_t pid = launch_process(c, in_fd, out_fd, pgid, pgid == 0, c->background,
+                                       job_cgroup_fd(job));
+            if (pid < 0) {
+                pl->status = 1;
+            } else {
+                job_add_proc(job, pid, !c->next_pipe);
+                if (!c->background)
+                    timing_stage_add(c, false, "process", pid);
+                if (pgid == 0)
+                    pl->pgid = pid;
+                if (!c->next_pipe)
+                    pl->last_forked = true;
+            }
 
-        if (in_fd != STDIN_FILENO)
-            close(in_fd);
-        if (c->next_pipe) {
-            close(out_fd);
-            in_fd = pipefd[0];
+            if (in_fd != STDIN_FILENO)
+                close(in_fd);
+            if (c->next_pipe)
+                close(out_fd);
         }
+        if (c->next_pipe)
+            in_fd = pipefd[0];
     }
+}
+
+static void cancel_pipeline_threads(void *arg) {
+    pipeline_launch_t *pl = arg;
+    cancel_stage_threads(pl->threads, pl->nthreads);
+}
 
-    if (!cmd->background && pgid > 0) {
-        int wstatus;
-        tcsetpgrp(STDIN_FILENO, pgid);
-        pid_t w;
-        do {
-            w = waitpid(-pgid, &wstatus, 0);
-        } while (w > 0 || (w < 0 && errno == EINTR));
-        tcsetpgrp(STDIN_FILENO, getpgrp());
-        if (WIFEXITED(wstatus))
-            status = WEXITSTATUS(wstatus);
-        else if (WIFSIGNALED(wstatus))
-            status = 128 + WTERMSIG(wstatus);
-    } else if (cmd->background && pgid > 0) {
-        jobs_add(pgid, cmd->argv[0], true);
-        printf("[bg] started %d\n", pgid);
+// Starts a background pipeline the job queue held back (set maxjobs).
+// Background stages never run on threads.
+void exec_start_queued(shell_state_t *sh, command_t *cmd, job_t *job) {
+    pipeline_launch_t pl;
+    launch_stages(sh, cmd, job, &pl);
+    free(pl.threads);
+}
+
+static int execute_pipeline(shell_state_t *sh, command_t *cmd) {
+    if (fuse_eligible(cmd)) {
+        timing_stage_t *ts = timing_stage_add(cmd, true, "fused", 0);
+        timing_stage_start(ts);
+        int status = fuse_run(cmd);
+        timing_stage_stop(ts, status);
+        return status;
     }
 
+    job_t *job = job_create(cmd, cmd->background);
+    if (cmd->background && !jobs_slot_free(sh)) {
+        job_enqueue(job, sh, cmd);
+        return 0;
+    }
+
+    pipeline_launch_t pl;
+    launch_stages(sh, cmd, job, &pl);
+    int status = pl.status;
+    sem_t finished;
+    start_stage_threads(pl.threads, pl.nthreads, &finished);
+    bool cancel = false;
+
+    if (cmd->background && pl.pgid > 0) {
+        job_background(job);
+    } else {
+        // The event loop reaps each stage as it exits; a job without
+        // processes (all threads) returns at once. Queued background
+        // jobs are not forked while thread stages run.
+        if (pl.pgid > 0)
+            tcsetpgrp(STDIN_FILENO, pl.pgid);
+        int job_status = pl.nthreads > 0
+                         ? job_wait_threads(job, cancel_pipeline_threads, &pl)
+                         : job_wait(job);
+        if (pl.last_forked)
+            status = job_status;
+        // ^C went to the job's process group, not to the shell
+        cancel = job_status == 128 + SIGINT;
+        if (pl.pgid > 0)
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+
+    join_stage_threads(pl.threads, pl.nthreads, &finished, cancel);
+    if (pl.last_thread)
+        status = pl.last_thread->status;
+    free(pl.threads);
     return status;
 }
 
-int execute_commands(shell_state_t *sh, command_t *cmd) {
+// Replaces the shell with argv[0] in the current process, like execve()
+// would: no fork, no wait. Only returns (with 127) if the command cannot
+// be started. Redirections must already be in place.
+int exec_replace(char **argv) {
+    char *path = pathcache_lookup(argv[0]);
+    if (!path) {
+        fprintf(stderr, "%s: command not found\n", argv[0]);
+        return 127;
+    }
+
+    const elf_image_t *image = loader_prepare(path);
+    if (!image) {
+        // Not a runnable image: the shell goes on as it was, so nothing
+        // may be torn down yet.
+        loader_report(path);
+        free(path);
+        return 127;
+    }
+    const env_block_t *env = envblock_get();
+
+    // Nothing of the shell survives the jump, so release what other
+    // processes are waiting on and push out pending output first.
+    zygote_cleanup();
+    fflush(stdout);
+    fflush(stderr);
+    signals_reset();
+
+    // The jump is not an execve(), so O_CLOEXEC does nothing: close the
+    // shell's own descriptors (epoll, pidfds, saved fds) by hand, as the
+    // forked path does. Past this point the shell can't go on.
+    close_fds_from(STDERR_FILENO + 1);
+    loader_exec_image(image, path, argv, env);
+    _exit(127);
+}
+
+// tail: nothing runs after c in the -c string
+static bool is_tail_call(shell_state_t *sh, command_t *c, char **argv, bool tail) {
+    return sh->tail_exec && tail && !c->next_pipe &&
+           !c->background && !is_builtin(argv[0]) && !jobs_queued() &&
+           !timing_active() && !cgroup_enabled();
+}
+
+static int run_simple(shell_state_t *sh, command_t *c, bool tail) {
+    // Word expansion, once per simple command, before anything runs
+    for (command_t *p = c; p; p = p->next_pipe)
+        expand_words(p);
+    // A command can expand to nothing ($@ without parameters)
+    bool empty = false;
+    for (command_t *p = c; p; p = p->next_pipe)
+        empty |= !p->argv[0];
+    if (empty) {
+        if (c->next_pipe)
+            fprintf(stderr, "empty command in pipeline\n");
+        return c->next_pipe ? 1 : 0;
+    }
+    // `time PIPELINE`: report what the pipeline cost once it is done
+    int timed = timing_prefix(c);
+    if (timed < 0)
+        return 2;
+    char **argv = c->argv;
+    int status;
+
+    if (is_tail_call(sh, c, argv, tail)) {
+        // Last command of a -c string: nothing runs after it, so become
+        // it instead of forking and waiting.
+        if (setup_redirs(c->redirs) < 0)
+            status = 1;
+        else
+            status = exec_replace(argv);
+    } else if (!c->next_pipe && is_builtin(argv[0]) && !c->background) {
+        // Builtins run in the shell itself; keep their redirections
+        // from outliving the command (exec is the one exception: either
+        // they stay for good or the shell is replaced).
+        bool keep = !c->redirs || strcmp(argv[0], "exec") == 0;
+        int saved_in = keep ? -1 : dup(STDIN_FILENO);
+        int saved_out = keep ? -1 : dup(STDOUT_FILENO);
+        if (setup_redirs(c->redirs) < 0) {
+            status = 1;
+        } else {
+            timing_stage_t *ts = timing_stage_add(c, false, "builtin", 0);
+            timing_stage_start(ts);
+            status = run_builtin(sh, c);
+            timing_stage_stop(ts, status);
+        }
+        fflush(stdout);
+        if (saved_in >= 0) {
+            dup2(saved_in, STDIN_FILENO);
+            close(saved_in);
+        }
+        if (saved_out >= 0) {
+            dup2(saved_out, STDOUT_FILENO);
+            close(saved_out);
+        }
+    } else {
+        status = execute_pipeline(sh, c);
+    }
+    if (timed)
+        timing_end(c, status);
+    return status;
+}
+
+static int run_list(shell_state_t *sh, command_t *list, bool tail);
+
+// Whether to stop running commands: `exit`, `break`/`continue`, or ^C
+// (during a loop only; a plain list goes on, as before).
+static bool stopping(shell_state_t *sh) {
+    return !sh->running || sh->breaking ||
+           (sh->loop_depth > 0 && signals_interrupted());
+}
+
+// The parts of a compound command are shared by every run of it, so
+// each run executes instances of them (command_instance()) made in the
+// command's arena, or for loop bodies in an arena of the loop's own
+// that is emptied after every iteration.
+static int run_if(shell_state_t *sh, command_t *c, bool tail) {
+    arena_t *a = c->arena;
+    int status = run_list(sh, command_instance(c->cond, a), false);
+    if (stopping(sh))
+        return status;
+    if (status == 0)
+        return run_list(sh, command_instance(c->body, a), tail);
+    if (c->else_part)
+        return run_list(sh, command_instance(c->else_part, a), tail);
+    return 0;
+}
+
+// while, until and for. Only builtins in the body means no fork at all,
+// and no parsing either: the body was parsed with the loop.
+static int run_loop(shell_state_t *sh, command_t *c) {
+    arena_t a = {0};
     int status = 0;
-    for (command_t *c = cmd; c; c = c->next_seq) {
-        // Expand glob patterns in argv
-        char **expanded_argv = expand_glob_patterns(c->argv);
-        bool was_expanded = (expanded_argv != c->argv);
-        
-        // Create temporary command with expanded argv
-        command_t temp_cmd = *c;
-        temp_cmd.argv = expanded_argv;
-        
-        if (!c->next_pipe && is_builtin(c->argv[0]) && !c->background) {
-            if (setup_redirs(c->redirs) < 0)
+    if (c->kind == CMD_FOR)
+        expand_words(c);  // the variable name never changes
+    if (sh->loop_depth == 0)
+        signals_clear_interrupt();  // a ^C from before the loop
+
+    sh->loop_depth++;
+    for (int i = 1; ; i++) {
+        if (c->kind == CMD_FOR) {
+            if (!c->argv[i])
+                break;
+            if (setenv(c->argv[0], c->argv[i], 1) < 0) {
+                perror("setenv");
                 status = 1;
-            else
-                status = run_builtin(sh, &temp_cmd);
-            sh->last_status = status;
-        } else {
-            status = execute_pipeline(sh, &temp_cmd);
-            sh->last_status = status;
-        }
-        
-        // Free expanded argv if it was expanded
-        if (was_expanded) {
-            for (int i = 0; expanded_argv[i]; i++) {
-                free(expanded_argv[i]);
+                break;
             }
-            free(expanded_argv);
+            if (strcmp(c->argv[0], "PATH") == 0)
+                pathcache_clear();
+            envblock_invalidate();
+        } else {
+            int cond = run_list(sh, command_instance(c->cond, &a), false);
+            if (stopping(sh) || (c->kind == CMD_WHILE ? cond != 0 : cond == 0))
+                break;
+        }
+        status = run_list(sh, command_instance(c->body, &a), false);
+        arena_reset(&a);
+        if (sh->breaking) {
+            // break N / continue N: this loop is one of the N
+            if (--sh->breaking > 0 || !sh->continuing)
+                break;
+            sh->continuing = false;
         }
+        if (stopping(sh) || status == 128 + SIGINT)
+            break;
+    }
+    sh->loop_depth--;
+    arena_free(&a);
+    if (sh->loop_depth == 0 && signals_interrupted()) {
+        signals_clear_interrupt();
+        status = 128 + SIGINT;
     }
     return status;
 }
 
+// Runs list left to right; && and || skip a pipeline by the status of
+// the last one that ran. tail: nothing runs after the list.
+static int run_list(shell_state_t *sh, command_t *list, bool tail) {
+    int status = 0;
+    command_next_t next_if = NEXT_ALWAYS;
+    for (command_t *c = list; c; c = c->next_seq) {
+        bool skip = (next_if == NEXT_AND && status != 0) ||
+                    (next_if == NEXT_OR && status == 0);
+        next_if = c->next_if;
+        if (skip)
+            continue;
+        bool last = tail && !c->next_seq;
+        switch (c->kind) {
+            case CMD_IF:
+                status = run_if(sh, c, last);
+                break;
+            case CMD_WHILE:
+            case CMD_UNTIL:
+            case CMD_FOR:
+                status = run_loop(sh, c);
+                break;
+            default:
+                status = run_simple(sh, c, last);
+                break;
+        }
+        sh->last_status = status;
+        params_status(status);
+        if (stopping(sh))
+            break;  // exit: nothing after it on the line runs
+    }
+    return status;
+}
 
+int execute_commands(shell_state_t *sh, command_t *cmd) {
+    pathcache_new_generation();
+    signals_clear_interrupt();  // a ^C at the prompt is not for this line
+    return run_list(sh, cmd, true);
+}
 
-
+// A command line that did not parse has status 2, as in other shells.
+void execute_syntax_error(shell_state_t *sh) {
+    sh->last_status = 2;
+    params_status(2);
+}
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Descriptor-to-descriptor copying for cat.
+//
+// Data is moved by the kernel whenever the pair of descriptors allows
+// it, so it never passes through a user buffer:
+//   file -> file   copy_file_range() (may share extents / copy in-kernel)
+//   file -> other  sendfile()
+//   pipe -> any    splice()          (also any -> pipe)
+// Each method is tried in that order and given up on when the kernel
+// refuses it before anything was copied (EINVAL, EXDEV, ...). Whatever is
+// left goes through a plain read()/write() loop with a large page-aligned
+// buffer. All methods use and advance the descriptors' file offsets.
+// A ^C caught by the shell (signals_interrupted()) ends the copy between
+// two calls with EINTR, so cat running in the shell can be stopped.
+
+#define COPY_CHUNK     (1L << 30)      // per kernel call
+#define SPLICE_CHUNK   (1L << 20)
+#define COPY_BUF_SIZE  (256 * 1024)
+#define COPY_BUF_ALIGN 4096
+
+typedef enum { KCOPY_FILE_RANGE, KCOPY_SENDFILE, KCOPY_SPLICE } kcopy_t;
+
+static ssize_t kcopy_once(kcopy_t how, int in_fd, int out_fd) {
+    switch (how) {
+    case KCOPY_FILE_RANGE:
+        return copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+    case KCOPY_SENDFILE:
+        return sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+    case KCOPY_SPLICE:
+        return splice(in_fd, NULL, out_fd, NULL, SPLICE_CHUNK,
+                      SPLICE_F_MOVE | SPLICE_F_MORE);
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+// Errors that only mean "not for this pair of descriptors".
+static bool kcopy_unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EXDEV ||
+           err == EOPNOTSUPP || err == EBADF || err == ETXTBSY;
+}
+
+// 1: copied to end of input, 0: method not usable, -1: error.
+static int kcopy(kcopy_t how, int in_fd, int out_fd) {
+    bool copied = false;
+    for (;;) {
+        if (signals_interrupted()) {
+            errno = EINTR;
+            return -1;
+        }
+        ssize_t n = kcopy_once(how, in_fd, out_fd);
+        if (n > 0) {
+            copied = true;
+            continue;
+        }
+        if (n == 0)
+            return 1;
+        if (errno == EINTR)
+            continue;
+        if (!copied && kcopy_unsupported(errno))
+            return 0;
+        return -1;
+    }
+}
+
+static int copy_rw(int in_fd, int out_fd) {
+    char *buf = aligned_alloc(COPY_BUF_ALIGN, COPY_BUF_SIZE);
+    if (!buf) {
+        perror("aligned_alloc");
+        exit(1);
+    }
+    int ret = 0;
+    for (;;) {
+        if (signals_interrupted()) {
+            errno = EINTR;
+            ret = -1;
+            break;
+        }
+        ssize_t n = read(in_fd, buf, COPY_BUF_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = -1;
+            break;
+        }
+        if (n == 0)
+            break;
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out_fd, buf + off, n - off);
+            if (w < 0) {
+                if (errno == EINTR && !signals_interrupted())
+                    continue;
+                ret = -1;
+                goto out;
+            }
+            off += w;
+        }
+    }
+out:
+    free(buf);  // leaves errno alone
+    return ret;
+}
+
+// Copies in_fd to out_fd until end of input. Returns 0, or -1 with errno
+// set (EPIPE when the reader of out_fd went away, EINTR after ^C).
+int copy_fd(int in_fd, int out_fd) {
+    struct stat in_st, out_st;
+    if (fstat(in_fd, &in_st) < 0 || fstat(out_fd, &out_st) < 0)
+        return -1;
+
+    // procfs/sysfs files claim size 0 and can't be trusted with the
+    // in-kernel paths; read them like anything else
+    bool in_file = S_ISREG(in_st.st_mode) && in_st.st_size > 0;
+    bool any_pipe = S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode);
+    int r = 0;
+
+    if (in_file && S_ISREG(out_st.st_mode))
+        r = kcopy(KCOPY_FILE_RANGE, in_fd, out_fd);
+    if (r == 0 && in_file)
+        r = kcopy(KCOPY_SENDFILE, in_fd, out_fd);
+    if (r == 0 && any_pipe)
+        r = kcopy(KCOPY_SPLICE, in_fd, out_fd);
+    if (r == 0)
+        return copy_rw(in_fd, out_fd);
+    return r < 0 ? -1 : 0;
+}
@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Fused builtin pipelines.
+//
+// A pipeline made only of cat, echo and grep never needs a process, a
+// thread or a kernel pipe: it is compiled into a chain of operators, each
+// pushing its output bytes straight into the next one. Input is read in
+// large blocks and lines are handed on as slices of the read buffer; a
+// line is only copied when it straddles two reads.
+//
+// The chain reproduces what the builtins print when connected by pipes,
+// byte for byte: cat passes bytes on unchanged, and grep matches and
+// prints only the part of a line before its first NUL (fputs). A chain
+// that is nothing but cat is handed to copy_fd() instead, so the kernel
+// moves the data.
+//
+// The shell runs the chain itself, so ^C reaches the shell's handler, not
+// a child: every read and write pass checks signals_interrupted(), and
+// SA_RESTART is off meanwhile so a blocked read() or write() returns.
+
+#define FUSE_READ_SIZE  (256 * 1024)
+#define FUSE_WRITE_SIZE (64 * 1024)
+
+typedef enum {
+    OP_CAT_FILES,   // cat FILE...        (source)
+    OP_CAT_INPUT,   // cat                (filter: passes bytes through)
+    OP_GREP_FILES,  // grep PATTERN FILE... (source)
+    OP_GREP_INPUT,  // grep PATTERN       (filter)
+    OP_ECHO,        // echo [-n] ARGS...  (source)
+    OP_SINK,        // the pipeline's final output descriptor
+} op_kind_t;
+
+typedef struct fuse_op {
+    op_kind_t       kind;
+    command_t      *cmd;
+    struct fuse_op *next;
+
+    // partial line carried over between input blocks
+    char   *carry;
+    size_t  carry_len;
+    size_t  carry_cap;
+
+    const char *pattern;    // grep
+    size_t      pattern_len;
+    bool        any;        // grep: matched
+    int         status;
+
+    // sink
+    int     fd;
+    char   *buf;
+    size_t  buf_len;
+} fuse_op_t;
+
+typedef struct fuse_chain {
+    fuse_op_t *ops;
+    int        nops;
+    bool       broken;      // the sink's reader went away, or ^C
+    bool       interrupted; // ^C
+} fuse_chain_t;
+
+static fuse_chain_t *chain;  // the chain being run
+
+static void op_feed(fuse_op_t *op, const char *p, size_t n);
+static void op_end(fuse_op_t *op);
+
+// True once the chain must stop; notices ^C.
+static bool chain_stopped(void) {
+    if (!chain->broken && signals_interrupted()) {
+        chain->interrupted = true;
+        chain->broken = true;
+    }
+    return chain->broken;
+}
+
+// ---- sink ----
+
+static void sink_write_all(fuse_op_t *sink, const char *p, size_t n) {
+    while (n > 0 && !chain_stopped()) {
+        ssize_t w = write(sink->fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EPIPE)
+                perror("write");
+            sink->status = (errno == EPIPE) ? 128 + SIGPIPE : 1;
+            chain->broken = true;
+            break;
+        }
+        p += w;
+        n -= w;
+    }
+}
+
+static void sink_flush(fuse_op_t *sink) {
+    sink_write_all(sink, sink->buf, sink->buf_len);
+    sink->buf_len = 0;
+}
+
+static void sink_write(fuse_op_t *sink, const char *p, size_t n) {
+    if (sink->buf_len + n > FUSE_WRITE_SIZE)
+        sink_flush(sink);
+    if (n >= FUSE_WRITE_SIZE) {
+        sink_write_all(sink, p, n);  // large pieces skip the buffer
+        return;
+    }
+    memcpy(sink->buf + sink->buf_len, p, n);
+    sink->buf_len += n;
+}
+
+// ---- operators ----
+
+// One complete line (with its '\n', unless it is the last, unterminated
+// one) arriving at op.
+static void op_line(fuse_op_t *op, const char *line, size_t len) {
+    switch (op->kind) {
+    case OP_GREP_FILES:
+    case OP_GREP_INPUT: {
+        const char *nul = memchr(line, '\0', len);
+        size_t slen = nul ? (size_t)(nul - line) : len;
+        if (memmem(line, slen, op->pattern, op->pattern_len)) {
+            op_feed(op->next, line, slen);
+            op->any = true;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void carry_append(fuse_op_t *op, const char *p, size_t n) {
+    if (op->carry_len + n > op->carry_cap) {
+        size_t cap = op->carry_cap ? op->carry_cap : 4096;
+        while (cap < op->carry_len + n)
+            cap *= 2;
+        op->carry = realloc(op->carry, cap);
+        if (!op->carry) {
+            perror("realloc");
+            exit(1);
+        }
+        op->carry_cap = cap;
+    }
+    memcpy(op->carry + op->carry_len, p, n);
+    op->carry_len += n;
+}
+
+// Splits incoming bytes into lines, the way getline() would see them.
+// cat needs no lines: its bytes go straight on.
+static void op_feed(fuse_op_t *op, const char *p, size_t n) {
+    if (op->kind == OP_SINK) {
+        sink_write(op, p, n);
+        return;
+    }
+    if (op->kind == OP_CAT_FILES || op->kind == OP_CAT_INPUT) {
+        op_feed(op->next, p, n);
+        return;
+    }
+    while (n > 0 && !chain->broken) {
+        const char *nl = memchr(p, '\n', n);
+        if (!nl) {
+            carry_append(op, p, n);
+            return;
+        }
+        size_t len = nl - p + 1;
+        if (op->carry_len) {
+            carry_append(op, p, len);
+            op_line(op, op->carry, op->carry_len);
+            op->carry_len = 0;
+        } else {
+            op_line(op, p, len);  // zero-copy: a slice of the caller's buffer
+        }
+        p += len;
+        n -= len;
+    }
+}
+
+// End of one input stream (a file, or the upstream operator): a pending
+// unterminated line is still a line.
+static void op_flush_carry(fuse_op_t *op) {
+    if (op->carry_len && !chain->broken)
+        op_line(op, op->carry, op->carry_len);
+    op->carry_len = 0;
+}
+
+static void op_end(fuse_op_t *op) {
+    if (op->kind == OP_SINK) {
+        sink_flush(op);
+        return;
+    }
+    op_flush_carry(op);
+    if (op->kind == OP_GREP_FILES || op->kind == OP_GREP_INPUT)
+        op->status = op->any ? 0 : 1;
+    op_end(op->next);
+}
+
+// Pushes everything readable from fd into op.
+static void pump_fd(fuse_op_t *op, int fd, char *buf) {
+    while (!chain_stopped()) {
+        ssize_t n = read(fd, buf, FUSE_READ_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            break;
+        }
+        if (n == 0)
+            break;
+        op_feed(op, buf, n);
+    }
+    op_flush_carry(op);
+}
+
+// True when everything from op up to the sink is cat.
+static bool cat_only(fuse_op_t *op) {
+    for (; op->kind != OP_SINK; op = op->next)
+        if (op->kind != OP_CAT_FILES && op->kind != OP_CAT_INPUT)
+            return false;
+    return true;
+}
+
+// A cat-only chain copies fd to the sink's descriptor in the kernel.
+static void copy_to_sink(fuse_op_t *src, int fd, const char *name) {
+    fuse_op_t *sink = &chain->ops[chain->nops - 1];
+    sink_flush(sink);
+    if (chain_stopped() || copy_fd(fd, sink->fd) == 0)
+        return;
+    if (errno == EPIPE) {
+        sink->status = 128 + SIGPIPE;
+        chain->broken = true;
+        return;
+    }
+    if (errno == EINTR) {
+        chain_stopped();
+        return;
+    }
+    perror(name);
+    src->status = 1;
+}
+
+// Reads one input of the source: into the chain, or around it.
+static void feed_source(fuse_op_t *src, int fd, const char *name, char *buf) {
+    if (cat_only(src))
+        copy_to_sink(src, fd, name);
+    else
+        pump_fd(src, fd, buf);
+}
+
+static void run_source(fuse_op_t *src, int in_fd, char *buf) {
+    command_t *cmd = src->cmd;
+    switch (src->kind) {
+    case OP_ECHO: {
+        int i = 1;
+        bool newline = true;
+        if (cmd->argv[1] && strcmp(cmd->argv[1], "-n") == 0) {
+            newline = false;
+            i = 2;
+        }
+        for (int first = i; cmd->argv[i]; i++) {
+            if (i > first)
+                op_feed(src->next, " ", 1);
+            op_feed(src->next, cmd->argv[i], strlen(cmd->argv[i]));
+        }
+        if (newline)
+            op_feed(src->next, "\n", 1);
+        op_end(src->next);
+        return;
+    }
+    case OP_CAT_FILES:
+    case OP_GREP_FILES:
+        for (int i = (src->kind == OP_CAT_FILES) ? 1 : 2; cmd->argv[i] && !chain->broken; i++) {
+            int fd = open(cmd->argv[i], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR && chain_stopped())
+                    break;  // ^C while a FIFO had no writer
+                perror(cmd->argv[i]);
+                if (src->kind == OP_CAT_FILES)
+                    src->status = 1;
+                continue;
+            }
+            feed_source(src, fd, cmd->argv[i], buf);
+            close(fd);
+        }
+        break;
+    default:
+        feed_source(src, in_fd, cmd->argv[0], buf);
+        break;
+    }
+    op_end(src);
+}
+
+// ---- compilation ----
+
+static bool classify(command_t *c, bool first, op_kind_t *kind) {
+    const char *name = c->argv[0];
+    if (strcmp(name, "echo") == 0) {
+        *kind = OP_ECHO;
+        return first;
+    }
+    if (strcmp(name, "cat") == 0) {
+        *kind = c->argv[1] ? OP_CAT_FILES : OP_CAT_INPUT;
+        return first || *kind == OP_CAT_INPUT;
+    }
+    if (strcmp(name, "grep") == 0 && c->argv[1]) {
+        *kind = c->argv[2] ? OP_GREP_FILES : OP_GREP_INPUT;
+        return first || *kind == OP_GREP_INPUT;
+    }
+    return false;
+}
+
+static bool fuse_enabled(void) {
+    const char *env = getenv("MINISHELL_PIPE_FUSE");
+    return !env || strcmp(env, "0") != 0;
+}
+
+// True for a foreground pipeline of two or more stages that are all cat,
+// echo or grep, where every stage after the first reads its input. Only
+// the first stage may redirect input and only the last may redirect
+// output. A first stage reading the terminal is left to a child.
+bool fuse_eligible(command_t *cmd) {
+    if (!cmd->next_pipe || !fuse_enabled())
+        return false;
+    for (command_t *c = cmd; c; c = c->next_pipe) {
+        op_kind_t kind;
+        if (c->background || !classify(c, c == cmd, &kind))
+            return false;
+        bool has_in = false;
+        for (redir_t *r = c->redirs; r; r = r->next) {
+            if (r->type == REDIR_IN) {
+                if (c != cmd)
+                    return false;
+                has_in = true;
+            } else if (c->next_pipe) {
+                return false;
+            }
+        }
+        if (c == cmd && (kind == OP_CAT_INPUT || kind == OP_GREP_INPUT) && !has_in)
+            return false;
+    }
+    return true;
+}
+
+int fuse_run(command_t *cmd) {
+    fuse_chain_t ch = {0};
+    for (command_t *c = cmd; c; c = c->next_pipe)
+        ch.nops++;
+    ch.nops++;  // sink
+    ch.ops = calloc(ch.nops, sizeof(fuse_op_t));
+    if (!ch.ops) {
+        perror("calloc");
+        exit(1);
+    }
+
+    int i = 0;
+    command_t *last = cmd;
+    for (command_t *c = cmd; c; c = c->next_pipe, i++) {
+        fuse_op_t *op = &ch.ops[i];
+        classify(c, c == cmd, &op->kind);
+        op->cmd = c;
+        op->next = &ch.ops[i + 1];
+        if (op->kind == OP_GREP_FILES || op->kind == OP_GREP_INPUT) {
+            op->pattern = c->argv[1];
+            op->pattern_len = strlen(c->argv[1]);
+        }
+        last = c;
+    }
+    fuse_op_t *sink = &ch.ops[ch.nops - 1];
+    sink->kind = OP_SINK;
+
+    // Same descriptor setup the stages would get, minus the pipes
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+    int status = 1;
+    signals_interruptible(true);  // opening a FIFO can block as well
+    if (redirect_stage_fds(cmd->redirs, &in_fd, &out_fd) < 0 ||
+        redirect_stage_fds(last->redirs, &in_fd, &out_fd) < 0) {
+        if (signals_interrupted())
+            status = 128 + SIGINT;
+        goto out;
+    }
+    sink->fd = out_fd;
+    sink->buf = xmalloc(FUSE_WRITE_SIZE);
+    char *rbuf = xmalloc(FUSE_READ_SIZE);
+
+    // A vanished reader must end the chain, not the shell
+    sigset_t pipe_set, old;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipe_set, &old);
+    fflush(stdout);
+
+    chain = &ch;
+    run_source(&ch.ops[0], in_fd, rbuf);
+    chain = NULL;
+
+    if (ch.broken) {
+        struct timespec zero = {0, 0};
+        while (sigtimedwait(&pipe_set, NULL, &zero) == SIGPIPE)
+            ;
+    }
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    // A broken sink is what the last stage would have died of
+    status = sink->status ? sink->status : ch.ops[ch.nops - 2].status;
+    if (ch.interrupted)
+        status = 128 + SIGINT;
+    free(rbuf);
+    free(sink->buf);
+out:
+    signals_interruptible(false);
+    if (in_fd > STDERR_FILENO)
+        close(in_fd);
+    if (out_fd > STDERR_FILENO)
+        close(out_fd);
+    for (int j = 0; j < ch.nops; j++)
+        free(ch.ops[j].carry);
+    free(ch.ops);
+    return status;
+}
@@ -7,38 +7,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+// The new argv, built in the command's arena like everything else of
+// its line.
 typedef struct {
+    arena_t *arena;
     char **items;
     int count;
     int capacity;
 } glob_list_t;
 
-static void glob_list_init(glob_list_t *list) {
+static void glob_list_init(glob_list_t *list, arena_t *arena) {
+    list->arena = arena;
     list->items = NULL;
     list->count = 0;
     list->capacity = 0;
 }
 
-static void glob_list_add(glob_list_t *list, const char *item) {
+static void glob_list_take(glob_list_t *list, char *item) {
     if (list->count >= list->capacity) {
-        list->capacity = list->capacity ? list->capacity * 2 : 16;
-        list->items = realloc(list->items, list->capacity * sizeof(char*));
-        if (!list->items) {
-            perror("realloc");
-            exit(1);
-        }
-    }
-    list->items[list->count++] = xstrdup(item);
-}
-
-static void glob_list_free(glob_list_t *list) {
-    if (list->items) {
-        for (int i = 0; i < list->count; i++) {
-            free(list->items[i]);
-        }
-        free(list->items);
+        int ncap = list->capacity ? list->capacity * 2 : 16;
+        list->items = arena_grow(list->arena, list->items, list->capacity * sizeof(char *),
+                                 ncap * sizeof(char *));
+        list->capacity = ncap;
     }
-    glob_list_init(list);
+    list->items[list->count++] = item;
 }
 
 static bool has_glob_chars(const char *pattern) {
@@ -61,107 +53,82 @@ static void expand_pattern_in_dir(const char *pattern, const char *dir, glob_lis
             // Build full path
             char *fullpath;
             if (strcmp(dir, ".") == 0) {
-                fullpath = xstrdup(ent->d_name);
+                fullpath = arena_strdup(list->arena, ent->d_name);
             } else {
                 size_t len = strlen(dir) + 1 + strlen(ent->d_name) + 1;
-                fullpath = xmalloc(len);
+                fullpath = arena_alloc(list->arena, len);
                 snprintf(fullpath, len, "%s/%s", dir, ent->d_name);
             }
-            glob_list_add(list, fullpath);
-            free(fullpath);
+            glob_list_take(list, fullpath);
         }
     }
     closedir(d);
 }
 
+// Adds every match of pattern (which has glob characters) to list.
 static void expand_pattern(const char *pattern, glob_list_t *list) {
     // Check if pattern contains directory separator
     const char *last_slash = strrchr(pattern, '/');
     
     if (last_slash) {
         // Pattern has directory component
+        const char *file_part = last_slash + 1;
+        if (!has_glob_chars(file_part))
+            return;  // globs in directory parts are not supported
         char *dir_part = xmalloc(last_slash - pattern + 1);
         memcpy(dir_part, pattern, last_slash - pattern);
         dir_part[last_slash - pattern] = '\0';
-        
-        const char *file_part = last_slash + 1;
-        
-        if (has_glob_chars(file_part)) {
-            expand_pattern_in_dir(file_part, dir_part, list);
-        } else {
-            // No glob in filename, just add as-is
-            glob_list_add(list, pattern);
-        }
+        expand_pattern_in_dir(file_part, dir_part, list);
         free(dir_part);
     } else {
         // Pattern is just filename, search in current directory
-        if (has_glob_chars(pattern)) {
-            expand_pattern_in_dir(pattern, ".", list);
-        } else {
-            // No glob chars, add as-is
-            glob_list_add(list, pattern);
-        }
+        expand_pattern_in_dir(pattern, ".", list);
     }
 }
 
-char **expand_glob_patterns(char **argv) {
-    if (!argv || !argv[0]) return argv;
-    
-    glob_list_t expanded;
-    glob_list_init(&expanded);
-    
-    bool any_expanded = false;
-    bool any_matches = false;
-    
-    // Always keep command name (first argument)
-    glob_list_add(&expanded, argv[0]);
-    
-    // Expand each argument starting from index 1
-    for (int i = 1; argv[i]; i++) {
-        if (has_glob_chars(argv[i])) {
-            any_expanded = true;
-            int before_count = expanded.count;
-            expand_pattern(argv[i], &expanded);
-            if (expanded.count > before_count) {
-                any_matches = true;
-            } else {
-                // No matches for this pattern - keep pattern as-is (standard shell behavior)
-                glob_list_add(&expanded, argv[i]);
-            }
-        } else {
-            glob_list_add(&expanded, argv[i]);
+// Word expansion for one simple command. Runs once, in the shell, before
+// anything is launched: cmd->argv is replaced by the final argument list,
+// allocated from the command's arena. Positional parameters are
+// substituted first (params_expand()), then globbing: words without glob
+// characters are moved over as they are; a pattern is replaced by its
+// matches, or kept as-is when nothing matches (standard shell behaviour).
+void expand_words(command_t *cmd) {
+    if (cmd->expanded || !cmd->argv || !cmd->argv[0])
+        return;
+    cmd->expanded = true;
+
+    params_expand(cmd);
+    if (!cmd->argv[0])
+        return;
+
+    bool any_glob = false;
+    for (int i = 1; cmd->argv[i]; i++) {
+        if (has_glob_chars(cmd->argv[i])) {
+            any_glob = true;
+            break;
         }
     }
+    if (!any_glob)
+        return;
+
+    glob_list_t expanded;
+    glob_list_init(&expanded, cmd->arena);
     
-    // If we expanded but got no matches, return original
-    if (any_expanded && !any_matches && expanded.count == 1) {
-        // Only command name, no arguments matched
-        glob_list_free(&expanded);
-        return argv;
-    }
+    // Always keep command name (first argument)
+    glob_list_take(&expanded, cmd->argv[0]);
     
-    // Add NULL terminator
-    if (expanded.count >= expanded.capacity) {
-        expanded.capacity = expanded.count + 1;
-        expanded.items = realloc(expanded.items, expanded.capacity * sizeof(char*));
-        if (!expanded.items) {
-            perror("realloc");
-            glob_list_free(&expanded);
-            return argv;
+    for (int i = 1; cmd->argv[i]; i++) {
+        char *word = cmd->argv[i];
+        if (!has_glob_chars(word)) {
+            glob_list_take(&expanded, word);
+            continue;
         }
+        int before_count = expanded.count;
+        expand_pattern(word, &expanded);
+        if (expanded.count == before_count)
+            glob_list_take(&expanded, word);
     }
-    expanded.items[expanded.count] = NULL;
     
-    return expanded.items;
+    glob_list_take(&expanded, NULL);
+    cmd->argv = expanded.items;
 }
-
-void free_glob_expansion(char **argv) {
-    if (!argv) return;
-    
-    // Check if this is a glob expansion (has more than original)
-    // For simplicity, we'll free all if it looks like an expansion
-    // In practice, we'd need to track which argv arrays were expanded
-    // For now, we'll rely on the command structure to handle this
-    (void)argv;
-}
-
@@ -2,6 +2,7 @@
 #include "shell.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,25 @@
 
 static struct termios saved_termios;
 static bool raw_mode = false;
+static bool stdin_seekable = false;
+
+// Whatever the shell runs reads stdin from where the shell stopped, so
+// the shell keeps no input it has read ahead: a terminal or pipe is read
+// unbuffered (lines a byte at a time, as other shells do), and a seekable
+// file's read-ahead is handed back before each command line runs
+// (input_sync()).
+void input_init(void) {
+    stdin_seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) >= 0;
+    if (!stdin_seekable)
+        setvbuf(stdin, NULL, _IONBF, 0);
+}
+
+// fflush() on a seekable input stream moves the descriptor back to the
+// stream's position and drops the buffer.
+void input_sync(void) {
+    if (stdin_seekable)
+        fflush(stdin);
+}
 
 static void enable_raw_mode(void) {
     if (raw_mode) return;
@@ -52,6 +72,66 @@ static int read_key(void) {
     return c;
 }
 
+#define KEY_JOB_EVENT (-2)
+
+// Like read_key(), but also returns KEY_JOB_EVENT as soon as a
+// background job has finished, so it can be reported while the user is
+// still typing.
+static int read_key_or_event(void) {
+    int efd = events_fd();
+    while (efd >= 0) {
+        struct pollfd fds[2] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = efd, .events = POLLIN},
+        };
+        // While the user types, park any zygotes the pool is short of
+        int ready = poll(fds, 2, zygote_pool_low() ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ready == 0) {
+            if (!zygote_refill_one())
+                break;
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            jobs_dispatch(0);
+            if (jobs_have_notices())
+                return KEY_JOB_EVENT;
+        }
+        if (fds[0].revents)
+            break;
+    }
+    return read_key();
+}
+
+// Prints finished-job notices on their own lines above the prompt, then
+// redraws the prompt and the line being edited with the cursor in place.
+static void show_job_notices(const char *line, size_t len, size_t cursor) {
+    fputs("\r\033[K", stdout);
+    fflush(stdout);
+    // raw mode turns off output processing; the notices need '\n' -> "\r\n"
+    struct termios t;
+    bool have_termios = tcgetattr(STDIN_FILENO, &t) == 0;
+    if (have_termios) {
+        struct termios cooked = t;
+        cooked.c_oflag |= OPOST;
+        tcsetattr(STDIN_FILENO, TCSANOW, &cooked);
+    }
+    jobs_notify();
+    if (have_termios)
+        tcsetattr(STDIN_FILENO, TCSANOW, &t);
+
+    fputs(get_prompt(), stdout);
+    if (len > 0)
+        fwrite(line, 1, len, stdout);
+    for (size_t i = cursor; i < len; i++)
+        fputc('\b', stdout);
+    fflush(stdout);
+}
+
 ssize_t read_line_with_history(char **lineptr, size_t *n) {
     if (!isatty(STDIN_FILENO)) {
         // Not a terminal, use regular getline
@@ -69,7 +149,11 @@ ssize_t read_line_with_history(char **lineptr, size_t *n) {
     history_reset_browse();
     
     while (1) {
-        int c = read_key();
+        int c = read_key_or_event();
+        if (c == KEY_JOB_EVENT) {
+            show_job_notices(line, len, cursor);
+            continue;
+        }
         if (c == EOF || c == '\n' || c == '\r') {
             disable_raw_mode();
             if (c == EOF && len == 0) {
@@ -5,70 +5,409 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <unistd.h>
+#include <time.h>
 
-typedef struct job {
-    pid_t pgid;
-    char *cmdline;
-    bool  background;
-    struct job *next;
-} job_t;
+// Job table.
+//
+// A job is one pipeline: every forked stage is a job_proc_t watched by
+// the event loop (events.c), which reports each exit here as soon as it
+// is reaped. The job's status is its last stage's, like $? for a
+// pipeline. Background jobs are listed until their completion has been
+// reported (by the notice before the prompt, while typing, by `jobs`,
+// or by `wait`); foreground jobs are never listed and are freed by the
+// caller once job_wait() returns.
+//
+// With `set maxjobs=N`, a background pipeline that would be the N+1th
+// running one is listed as queued instead, holding a copy of its
+// command. Queued jobs start in submission order as running ones finish
+// (checked each time the event loop runs), so a script can submit any
+// number of jobs and at most N run at once.
+
+struct job {
+    int          id;          // %N
+    pid_t        pgid;
+    char        *cmdline;
+    bool         background;
+    job_proc_t  *procs;
+    int          nprocs;
+    int          cap;         // one per stage
+    int          remaining;   // stages still running
+    int          status;      // last stage's status, once it is done
+    command_t   *queued_cmd;  // not started yet (set maxjobs)
+    arena_t      arena;       // holds queued_cmd
+    shell_state_t *sh;        // the shell that queued it
+    time_t       queued_at;
+    time_t       started_at;
+    time_t       ended_at;
+    cgroup_leaf_t *cgroup;    // cgroup on: made when the first stage forks
+    struct job  *next;
+};
 
 static job_t *jobs_head = NULL;
+static bool   queue_held = false;  // don't fork queued jobs (thread stages running)
 
 void jobs_init(void) {
     jobs_head = NULL;
+    events_init();
 }
 
-void jobs_add(pid_t pgid, const char *cmdline, bool background) {
+// One process slot per stage, allocated up front: the event loop holds
+// on to each job_proc_t by address.
+job_t *job_create(command_t *cmd, bool background) {
     job_t *j = xmalloc(sizeof(*j));
-    j->pgid = pgid;
-    j->cmdline = xstrdup(cmdline);
+    memset(j, 0, sizeof(*j));
+    j->cmdline = command_text(cmd, true);
     j->background = background;
-    j->next = jobs_head;
-    jobs_head = j;
+    j->queued_at = j->started_at = time(NULL);
+    for (command_t *c = cmd; c; c = c->next_pipe)
+        j->cap++;
+    j->procs = xmalloc(j->cap * sizeof(*j->procs));
+    return j;
 }
 
-static void jobs_remove(pid_t pgid) {
-    job_t **pp = &jobs_head;
-    while (*pp) {
-        if ((*pp)->pgid == pgid) {
-            job_t *dead = *pp;
-            *pp = dead->next;
-            free(dead->cmdline);
-            free(dead);
+// The descriptor of the job's own cgroup leaf to start its processes
+// in, -1 if there is none.
+int job_cgroup_fd(job_t *j) {
+    if (!j->cgroup)
+        j->cgroup = cgroup_leaf_create();
+    return cgroup_leaf_fd(j->cgroup);
+}
+
+cgroup_leaf_t *job_cgroup(const job_t *j) {
+    return j->cgroup;
+}
+
+// Starts watching one forked stage. The last stage's status becomes the
+// job's.
+void job_add_proc(job_t *j, pid_t pid, bool last) {
+    if (j->nprocs == j->cap)
+        return;
+    if (j->pgid == 0)
+        j->pgid = pid;
+    job_proc_t *p = &j->procs[j->nprocs++];
+    p->pid = pid;
+    p->job = j;
+    p->status = 0;
+    p->done = false;
+    p->last = last;
+    j->remaining++;
+    events_watch(p);
+}
+
+pid_t job_pgid(const job_t *j) {
+    return j->pgid;
+}
+
+// Queued jobs count as running: they are not done yet.
+bool job_running(const job_t *j) {
+    return j->queued_cmd || j->remaining > 0;
+}
+
+void jobs_proc_exited(job_proc_t *p, int status, const struct rusage *ru) {
+    job_t *j = p->job;
+    p->done = true;
+    p->status = status;
+    j->remaining--;
+    if (p->last)
+        j->status = status;
+    if (j->remaining == 0)
+        j->ended_at = time(NULL);
+    if (!j->background) {
+        loader_report_faults(p->pid, ru);
+        timing_proc_exited(p->pid, status, ru);
+    }
+}
+
+static void job_free(job_t *j) {
+    for (int i = 0; i < j->nprocs; i++) {
+        if (!j->procs[i].done)
+            events_unwatch(&j->procs[i]);
+    }
+    arena_free(&j->arena);
+    cgroup_leaf_destroy(j->cgroup);
+    free(j->procs);
+    free(j->cmdline);
+    free(j);
+}
+
+// ---- queue (set maxjobs) ----
+
+static int running_background(void) {
+    int n = 0;
+    for (job_t *j = jobs_head; j; j = j->next) {
+        if (!j->queued_cmd && j->remaining > 0)
+            n++;
+    }
+    return n;
+}
+
+bool jobs_slot_free(const shell_state_t *sh) {
+    return sh->max_jobs <= 0 || running_background() < sh->max_jobs;
+}
+
+bool jobs_queued(void) {
+    for (job_t *j = jobs_head; j; j = j->next) {
+        if (j->queued_cmd)
+            return true;
+    }
+    return false;
+}
+
+// Starts queued jobs, oldest first, while there are free slots.
+static void start_queued(void) {
+    if (queue_held)
+        return;
+    for (job_t *j = jobs_head; j; j = j->next) {
+        if (!j->queued_cmd)
+            continue;
+        if (!jobs_slot_free(j->sh))
             return;
+        command_t *cmd = j->queued_cmd;
+        j->queued_cmd = NULL;
+        j->started_at = time(NULL);
+        exec_start_queued(j->sh, cmd, j);
+        arena_free(&j->arena);
+        if (j->nprocs == 0) {
+            j->status = 1;  // nothing could be launched
+            j->ended_at = j->started_at;
         }
-        pp = &(*pp)->next;
     }
 }
 
-void jobs_reap(bool blocking) {
-    int status;
-    int options = blocking ? 0 : WNOHANG;
-    pid_t pid;
+// The event loop plus the queue: reaps what has exited, then fills the
+// slots that freed up. Before it would block, it tops up the zygote pool
+// one child at a time for as long as nothing else is ready.
+int jobs_dispatch(int timeout_ms) {
+    start_queued();
+    int n = 0;
+    while (timeout_ms != 0 && n == 0 && zygote_refill_one())
+        n = events_dispatch(0);
+    if (n == 0)
+        n = events_dispatch(timeout_ms);
+    int err = errno;
+    start_queued();
+    errno = err;
+    return n;
+}
+
+// Waits until every queued job has been started (not finished).
+void jobs_drain_queue(void) {
+    while (jobs_queued())
+        jobs_dispatch(-1);
+}
 
-    while ((pid = waitpid(-1, &status, options)) > 0) {
-        printf("[bg] process %d finished\n", pid);
-        jobs_remove(pid);
+// Waits for every stage of j. Returns the job's status; 128+SIGINT if a
+// signal cut the wait short (interruptible only).
+static int job_wait_until_done(job_t *j, bool interruptible) {
+    while (job_running(j)) {
+        if (jobs_dispatch(-1) < 0 && errno == EINTR && interruptible)
+            return 128 + SIGINT;
     }
-    if (pid < 0 && errno != ECHILD && errno != EINTR) {
-        perror("waitpid");
+    return j->status;
+}
+
+// Foreground: waits for the whole job and frees it.
+int job_wait(job_t *j) {
+    int status = job_wait_until_done(j, false);
+    job_free(j);
+    return status;
+}
+
+// job_wait() for a job whose pipeline also has thread stages. Queued
+// jobs are not forked meanwhile. Those run in the shell, so a ^C the shell catches while
+// waiting is theirs: on_interrupt(arg) is called once to stop them.
+int job_wait_threads(job_t *j, void (*on_interrupt)(void *), void *arg) {
+    queue_held = true;
+    bool told = false;
+    while (job_running(j)) {
+        if (!told && signals_interrupted()) {
+            on_interrupt(arg);
+            told = true;
+        }
+        jobs_dispatch(-1);
     }
+    int status = j->status;
+    queue_held = false;
+    job_free(j);
+    return status;
 }
 
-void jobs_print(void) {
+static void job_list(job_t *j) {
+    int id = 1;
+    for (job_t *o = jobs_head; o; o = o->next) {
+        if (o->id >= id)
+            id = o->id + 1;
+    }
+    j->id = id;
+    // keep the list in job-number order
+    job_t **pp = &jobs_head;
+    while (*pp)
+        pp = &(*pp)->next;
+    *pp = j;
+}
+
+// Background: lists the job and announces it.
+void job_background(job_t *j) {
+    job_list(j);
+    printf("[bg] started %d [%d]\n", (int)j->pgid, j->id);
+}
+
+// Background, no free slot: lists the job as queued with its own copy
+// of the pipeline.
+void job_enqueue(job_t *j, shell_state_t *sh, command_t *cmd) {
+    j->queued_cmd = command_clone(cmd, &j->arena);
+    j->sh = sh;
+    job_list(j);
+    printf("[bg] queued [%d]\n", j->id);
+}
+
+static void job_unlist(job_t *j) {
+    for (job_t **pp = &jobs_head; *pp; pp = &(*pp)->next) {
+        if (*pp == j) {
+            *pp = j->next;
+            job_free(j);
+            return;
+        }
+    }
+}
+
+bool jobs_have_notices(void) {
+    for (job_t *j = jobs_head; j; j = j->next) {
+        if (!job_running(j))
+            return true;
+    }
+    return false;
+}
+
+// Reports (and drops) every background job that has finished.
+void jobs_notify(void) {
+    jobs_dispatch(0);
     job_t *j = jobs_head;
     while (j) {
-        printf("[%d] %s %s\n", (int)j->pgid,
-               j->background ? "Running" : "Done",
-               j->cmdline);
-        j = j->next;
+        job_t *next = j->next;
+        if (!job_running(j)) {
+            printf("[bg] [%d] done (status %d): %s\n", j->id, j->status, j->cmdline);
+            job_unlist(j);
+        }
+        j = next;
     }
+    fflush(stdout);
 }
 
+static void print_proc(const job_proc_t *p) {
+    if (!p->done)
+        printf("      %d running\n", (int)p->pid);
+    else if (p->status > 128)
+        printf("      %d killed by signal %d\n", (int)p->pid, p->status - 128);
+    else
+        printf("      %d exited %d\n", (int)p->pid, p->status);
+}
 
+static const char *clock_str(time_t t, char *buf, size_t len) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, len, "%H:%M:%S", &tm);
+    return buf;
+}
 
+// jobs [-l] [-v]: state and times of every background job; -l adds
+// every stage's pid and state, -v the job's cgroup usage
+void jobs_print(bool long_format, bool usage) {
+    jobs_dispatch(0);
+    job_t *j = jobs_head;
+    while (j) {
+        job_t *next = j->next;
+        char t0[16], t1[16];
+        if (j->queued_cmd)
+            printf("[%d] -     Queued  since %s  %s\n", j->id,
+                   clock_str(j->queued_at, t0, sizeof(t0)), j->cmdline);
+        else if (job_running(j))
+            printf("[%d] %d Running since %s  %s\n", j->id, (int)j->pgid,
+                   clock_str(j->started_at, t0, sizeof(t0)), j->cmdline);
+        else
+            printf("[%d] %d Done (status %d) %s-%s  %s\n", j->id, (int)j->pgid, j->status,
+                   clock_str(j->started_at, t0, sizeof(t0)),
+                   clock_str(j->ended_at, t1, sizeof(t1)), j->cmdline);
+        if (long_format) {
+            for (int i = 0; i < j->nprocs; i++)
+                print_proc(&j->procs[i]);
+        }
+        if (usage)
+            cgroup_leaf_print(j->cgroup);
+        if (!job_running(j))
+            job_unlist(j);
+        j = next;
+    }
+}
+
+job_t *jobs_find(const char *spec) {
+    if (spec[0] == '%') {
+        int id = atoi(spec + 1);
+        for (job_t *j = jobs_head; j; j = j->next) {
+            if (j->id == id)
+                return j;
+        }
+        return NULL;
+    }
+    pid_t pid = atoi(spec);
+    for (job_t *j = jobs_head; j; j = j->next) {
+        for (int i = 0; i < j->nprocs; i++) {
+            if (j->procs[i].pid == pid)
+                return j;
+        }
+    }
+    return NULL;
+}
+
+// wait %N | PID: waits for that job; its status, 127 if unknown
+int jobs_wait_job(const char *spec) {
+    job_t *j = jobs_find(spec);
+    if (!j) {
+        fprintf(stderr, "wait: %s: no such job\n", spec);
+        return 127;
+    }
+    int status = job_wait_until_done(j, true);
+    if (!job_running(j))
+        job_unlist(j);
+    return status;
+}
 
+// wait -n: waits for the next background job to finish (one that has
+// already finished counts); its status, 127 if there are no jobs
+int jobs_wait_next(void) {
+    if (!jobs_head)
+        return 127;
+    for (;;) {
+        for (job_t *j = jobs_head; j; j = j->next) {
+            if (!job_running(j)) {
+                int status = j->status;
+                job_unlist(j);
+                return status;
+            }
+        }
+        if (jobs_dispatch(-1) < 0 && errno == EINTR)
+            return 128 + SIGINT;
+    }
+}
+
+// wait: waits for every background job; the last one's status
+int jobs_wait_all(void) {
+    int status = 0;
+    while (jobs_head) {
+        job_t *j = jobs_head;
+        status = job_wait_until_done(j, true);
+        if (job_running(j))
+            return status;  // interrupted
+        job_unlist(j);
+    }
+    return status;
+}
+
+void jobs_cleanup(void) {
+    while (jobs_head) {
+        job_t *j = jobs_head;
+        jobs_head = j->next;
+        job_free(j);
+    }
+    events_cleanup();
+}
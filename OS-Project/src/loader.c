@@ -8,20 +8,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/auxv.h>
 #include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 extern void loader_trampoline(void *entry, void *stack_top);
 
+// Upper bound on program headers read onto the stack; real executables
+// have a dozen or so.
+#define LOADER_MAX_PHDRS 64
+
+// Longest PT_INTERP path accepted (ld-linux-x86-64.so.2 and friends).
+#define LOADER_INTERP_MAX 256
+
 static void die(const char *msg) {
     perror(msg);
     _exit(127);
 }
 
-static void *map_stack(size_t size, void **out_top) {
-    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+static void *map_stack(size_t size, int prot, void **out_top) {
+    void *base = mmap(NULL, size, prot,
                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
     if (base == MAP_FAILED)
         die("mmap stack");
@@ -29,38 +40,69 @@ static void *map_stack(size_t size, void **out_top) {
     return base;
 }
 
+// Image facts the auxiliary vector needs to describe the new program.
+typedef struct elf_info {
+    uintptr_t phdr;   // in-memory address of the program header table
+    uintptr_t phnum;
+    uintptr_t entry;
+    uintptr_t base;   // interpreter base, 0 when there is none
+} elf_info_t;
+
+// Number of auxv (type, value) pairs written by build_initial_stack(),
+// including the terminating AT_NULL.
+#define AUXV_MAX_PAIRS 24
+
+static uintptr_t *push_aux(uintptr_t *auxv, uintptr_t type, uintptr_t val) {
+    auxv[0] = type;
+    auxv[1] = val;
+    return auxv + 2;
+}
+
 static void build_initial_stack(void *stack_base, void **stack_top,
                                 const char *path,
                                 char *const argv[],
-                                char *const envp[]) {
+                                const env_block_t *env,
+                                const elf_info_t *info) {
     (void)stack_base;
     uintptr_t sp = (uintptr_t)*stack_top;
 
     int argc = 0;
     while (argv[argc])
         argc++;
-    int envc = 0;
-    while (envp && envp[envc])
-        envc++;
+    int envc = env->count;
 
-    size_t total_len = strlen(path) + 1;
+    static const char platform[] = "x86_64";
+    size_t total_len = strlen(path) + 1 + sizeof(platform);
     for (int i = 0; i < argc; i++)
         total_len += strlen(argv[i]) + 1;
-    for (int i = 0; i < envc; i++)
-        total_len += strlen(envp[i]) + 1;
+    total_len += env->len;
 
     sp &= ~0xFul;
 
+    // 16 bytes for AT_RANDOM, kept 16-byte aligned below the strings
     sp -= total_len;
-    char *str_base = (char *)sp;
-    char *p = str_base;
+    sp &= ~0xFul;
+    sp -= 16;
+    unsigned char *random_bytes = (unsigned char *)sp;
+    if (getrandom(random_bytes, 16, GRND_NONBLOCK) != 16) {
+        const void *own = (const void *)getauxval(AT_RANDOM);
+        if (own)
+            memcpy(random_bytes, own, 16);
+        else
+            memset(random_bytes, 0, 16);
+    }
+
+    char *p = (char *)random_bytes + 16;
 
     char *path_copy = p;
     memcpy(p, path, strlen(path) + 1);
     p += strlen(path) + 1;
 
+    char *platform_copy = p;
+    memcpy(p, platform, sizeof(platform));
+    p += sizeof(platform);
+
     char **argv_ptrs = alloca((argc + 1) * sizeof(char *));
-    char **envp_ptrs = alloca((envc + 1) * sizeof(char *));
 
     for (int i = 0; i < argc; i++) {
         argv_ptrs[i] = p;
@@ -70,25 +112,57 @@ static void build_initial_stack(void *stack_base, void **stack_top,
     }
     argv_ptrs[argc] = NULL;
 
-    for (int i = 0; i < envc; i++) {
-        envp_ptrs[i] = p;
-        size_t len = strlen(envp[i]) + 1;
-        memcpy(p, envp[i], len);
-        p += len;
-    }
-    envp_ptrs[envc] = NULL;
-
-    sp &= ~0xFul;
-
-    sp -= sizeof(uintptr_t) * 2;
-    uintptr_t *auxv = (uintptr_t *)sp;
-    auxv[0] = 0;
-    auxv[1] = 0;
+    // The environment is already packed; one copy, then rebase offsets.
+    char *env_strings = p;
+    memcpy(p, env->strings, env->len);
+    p += env->len;
+
+    // Build the auxv in a scratch array first so its size is known.
+    uintptr_t aux[AUXV_MAX_PAIRS * 2];
+    uintptr_t *a = aux;
+    unsigned long vdso = getauxval(AT_SYSINFO_EHDR);
+    if (vdso)
+        a = push_aux(a, AT_SYSINFO_EHDR, vdso);
+    a = push_aux(a, AT_HWCAP, getauxval(AT_HWCAP));
+    a = push_aux(a, AT_PAGESZ, (uintptr_t)sysconf(_SC_PAGESIZE));
+    a = push_aux(a, AT_CLKTCK, getauxval(AT_CLKTCK));
+    a = push_aux(a, AT_PHDR, info->phdr);
+    a = push_aux(a, AT_PHENT, sizeof(Elf64_Phdr));
+    a = push_aux(a, AT_PHNUM, info->phnum);
+    a = push_aux(a, AT_BASE, info->base);
+    a = push_aux(a, AT_FLAGS, 0);
+    a = push_aux(a, AT_ENTRY, info->entry);
+    a = push_aux(a, AT_UID, getuid());
+    a = push_aux(a, AT_EUID, geteuid());
+    a = push_aux(a, AT_GID, getgid());
+    a = push_aux(a, AT_EGID, getegid());
+    a = push_aux(a, AT_SECURE, getauxval(AT_SECURE));
+    a = push_aux(a, AT_RANDOM, (uintptr_t)random_bytes);
+    a = push_aux(a, AT_HWCAP2, getauxval(AT_HWCAP2));
+    a = push_aux(a, AT_EXECFN, (uintptr_t)path_copy);
+    a = push_aux(a, AT_PLATFORM, (uintptr_t)platform_copy);
+#ifdef AT_MINSIGSTKSZ
+    unsigned long minsig = getauxval(AT_MINSIGSTKSZ);
+    if (minsig)
+        a = push_aux(a, AT_MINSIGSTKSZ, minsig);
+#endif
+    a = push_aux(a, AT_NULL, 0);
+    size_t aux_words = (size_t)(a - aux);
+
+    sp = (uintptr_t)random_bytes;
+
+    // The entry point expects %rsp 16-byte aligned while pointing at argc.
+    size_t words = 1 + (argc + 1) + (envc + 1) + aux_words;
+    if (words & 1)
+        sp -= sizeof(uintptr_t);
+
+    sp -= sizeof(uintptr_t) * aux_words;
+    memcpy((void *)sp, aux, sizeof(uintptr_t) * aux_words);
 
     sp -= sizeof(uintptr_t) * (envc + 1);
     uintptr_t *envp_area = (uintptr_t *)sp;
     for (int i = 0; i < envc; i++)
-        envp_area[i] = (uintptr_t)envp_ptrs[i];
+        envp_area[i] = (uintptr_t)(env_strings + env->offsets[i]);
     envp_area[envc] = 0;
 
     sp -= sizeof(uintptr_t) * (argc + 1);
@@ -101,101 +175,665 @@ static void build_initial_stack(void *stack_base, void **stack_top,
     uintptr_t *argc_area = (uintptr_t *)sp;
     *argc_area = (uintptr_t)argc;
 
-    (void)path_copy;
     *stack_top = (void *)sp;
 }
 
-int loader_run_elf(const char *path, char *const argv[], char *const envp[]) {
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        perror(path);
-        return 127;
+// Finds where the program header table ends up in memory: PT_PHDR if the
+// image has one, otherwise the PT_LOAD segment that covers e_phoff.
+static uintptr_t phdr_address(const Elf64_Ehdr *eh, const Elf64_Phdr *phdrs) {
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (phdrs[i].p_type == PT_PHDR)
+            return phdrs[i].p_vaddr;
+    }
+    for (int i = 0; i < eh->e_phnum; i++) {
+        const Elf64_Phdr *ph = &phdrs[i];
+        if (ph->p_type == PT_LOAD && eh->e_phoff >= ph->p_offset &&
+            eh->e_phoff < ph->p_offset + ph->p_filesz)
+            return ph->p_vaddr + (eh->e_phoff - ph->p_offset);
     }
+    return 0;
+}
+
+// A validated image and its precomputed mapping plan. Parsing happens
+// once in the parent (loader_prepare); a child only opens the file and
+// replays the plan (loader_exec_image).
+typedef struct elf_segment {
+    uintptr_t addr;       // page-aligned start of the mapping
+    off_t     offset;     // page-aligned file offset
+    size_t    file_len;   // bytes backed by the file, from addr
+    size_t    mem_len;    // total bytes including .bss, from addr
+    int       prot;
+} elf_segment_t;
+
+struct elf_image {
+    // identity of the file the plan was built from
+    dev_t           dev;
+    ino_t           ino;
+    off_t           size;
+    struct timespec mtime;
+
+    uintptr_t     entry;      // link-time addresses; add the load bias
+    uintptr_t     phdr;
+    int           phnum;
+    bool          pie;        // ET_DYN: placed wherever the reservation lands
+    uintptr_t     span_lo;    // page-aligned extent of all PT_LOAD segments
+    uintptr_t     span_hi;
+    size_t        max_align;  // largest PT_LOAD p_align
+    char          interp[LOADER_INTERP_MAX];  // PT_INTERP path, "" if static
+    int           nseg;
+    elf_segment_t seg[LOADER_MAX_PHDRS];
+    size_t        stack_size; // PT_GNU_STACK p_memsz, 0 if unspecified
+    int           stack_prot;
+
+    unsigned      policy;     // LOADER_POLICY_* flags for the next launch
+    long          parse_ns;   // cost of building this plan
+    struct elf_image *next;
+};
+
+#define LOADER_CACHE_MAX 64
+
+// Per-binary loader policies
+#define LOADER_POLICY_POPULATE  0x1   // MAP_POPULATE every segment
+#define LOADER_POLICY_WILLNEED  0x2   // MADV_WILLNEED on file-backed segments
+#define LOADER_POLICY_HUGETEXT  0x4   // MADV_HUGEPAGE on large text segments
+
+#define HUGE_TEXT_MIN  (2UL * 1024 * 1024)
+#define STACK_DEFAULT  (8UL * 1024 * 1024)
+#define STACK_MIN      (128UL * 1024)
+#define STACK_MAX      (256UL * 1024 * 1024)
+
+typedef struct loader_policy {
+    char     *name;   // command basename or full path
+    unsigned  flags;
+    struct loader_policy *next;
+} loader_policy_t;
+
+static loader_policy_t *policies = NULL;
+static bool report_faults = false;
+
+static elf_image_t *image_cache = NULL;
+static int  image_count = 0;
+static long cache_hits = 0;
+static long cache_misses = 0;
+static long miss_ns_total = 0;
+
+#define PAGE_DOWN(x) ((x) & ~(uintptr_t)0xFFF)
+#define PAGE_UP(x)   (((x) + 0xFFF) & ~(uintptr_t)0xFFF)
+
+static long elapsed_ns(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) * 1000000000L + (t1.tv_nsec - t0->tv_nsec);
+}
 
+static bool same_file(const elf_image_t *img, const struct stat *st) {
+    return img->dev == st->st_dev && img->ino == st->st_ino &&
+           img->size == st->st_size &&
+           img->mtime.tv_sec == st->st_mtim.tv_sec &&
+           img->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Reads and validates the headers of an open ELF file and fills in the
+// mapping plan. Returns -1 if it can't be run, printing why if verbose.
+static int parse_image(int fd, const char *path, elf_image_t *img, bool verbose) {
     Elf64_Ehdr eh;
-    if (read(fd, &eh, sizeof(eh)) != sizeof(eh)) {
-        perror("read ELF header");
-        close(fd);
-        return 127;
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh)) {
+        if (verbose)
+            fprintf(stderr, "%s: cannot read ELF header\n", path);
+        return -1;
     }
 
     if (memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
         eh.e_ident[EI_CLASS] != ELFCLASS64 ||
-        eh.e_type != ET_EXEC ||
+        (eh.e_type != ET_EXEC && eh.e_type != ET_DYN) ||
         eh.e_machine != EM_X86_64) {
-        fprintf(stderr, "%s: unsupported ELF file\n", path);
+        if (verbose)
+            fprintf(stderr, "%s: unsupported ELF file\n", path);
+        return -1;
+    }
+
+    if (eh.e_phentsize != sizeof(Elf64_Phdr) || eh.e_phnum <= 0 ||
+        eh.e_phnum > LOADER_MAX_PHDRS) {
+        if (verbose)
+            fprintf(stderr, "%s: bad program headers\n", path);
+        return -1;
+    }
+
+    Elf64_Phdr phdrs[LOADER_MAX_PHDRS];
+    ssize_t want = eh.e_phnum * sizeof(Elf64_Phdr);
+    if (pread(fd, phdrs, want, eh.e_phoff) != want) {
+        if (verbose)
+            fprintf(stderr, "%s: cannot read program headers\n", path);
+        return -1;
+    }
+
+    img->nseg = 0;
+    img->stack_size = 0;
+    img->stack_prot = PROT_READ | PROT_WRITE;
+    img->policy = 0;
+    img->pie = (eh.e_type == ET_DYN);
+    img->span_lo = UINTPTR_MAX;
+    img->span_hi = 0;
+    img->max_align = 0x1000;
+    img->interp[0] = '\0';
+    for (int i = 0; i < eh.e_phnum; i++) {
+        Elf64_Phdr *ph = &phdrs[i];
+        if (ph->p_type == PT_GNU_STACK) {
+            img->stack_size = ph->p_memsz;
+            if (ph->p_flags & PF_X)
+                img->stack_prot |= PROT_EXEC;
+            continue;
+        }
+        if (ph->p_type == PT_INTERP) {
+            if (ph->p_filesz < 2 || ph->p_filesz > LOADER_INTERP_MAX ||
+                pread(fd, img->interp, ph->p_filesz, ph->p_offset) != (ssize_t)ph->p_filesz ||
+                img->interp[ph->p_filesz - 1] != '\0') {
+                if (verbose)
+                    fprintf(stderr, "%s: bad PT_INTERP\n", path);
+                return -1;
+            }
+            continue;
+        }
+        if (ph->p_type != PT_LOAD)
+            continue;
+        if (ph->p_filesz > ph->p_memsz ||
+            (ph->p_offset & 0xFFF) != (ph->p_vaddr & 0xFFF)) {
+            if (verbose)
+                fprintf(stderr, "%s: bad PT_LOAD segment\n", path);
+            return -1;
+        }
+
+        elf_segment_t *sg = &img->seg[img->nseg++];
+        uintptr_t page_off = ph->p_vaddr & 0xFFF;
+        sg->addr = PAGE_DOWN(ph->p_vaddr);
+        sg->offset = ph->p_offset - page_off;
+        sg->file_len = page_off + ph->p_filesz;
+        sg->mem_len = page_off + ph->p_memsz;
+        sg->prot = 0;
+        if (ph->p_flags & PF_R) sg->prot |= PROT_READ;
+        if (ph->p_flags & PF_W) sg->prot |= PROT_WRITE;
+        if (ph->p_flags & PF_X) sg->prot |= PROT_EXEC;
+
+        if (sg->addr < img->span_lo)
+            img->span_lo = sg->addr;
+        if (PAGE_UP(sg->addr + sg->mem_len) > img->span_hi)
+            img->span_hi = PAGE_UP(sg->addr + sg->mem_len);
+        if (ph->p_align > img->max_align)
+            img->max_align = ph->p_align;
+    }
+    if (img->nseg == 0) {
+        if (verbose)
+            fprintf(stderr, "%s: no loadable segments\n", path);
+        return -1;
+    }
+    // An executable PIE has an entry point; a plain shared library doesn't.
+    if (img->pie && eh.e_entry == 0) {
+        if (verbose)
+            fprintf(stderr, "%s: no entry point\n", path);
+        return -1;
+    }
+    if (img->max_align & (img->max_align - 1)) {
+        if (verbose)
+            fprintf(stderr, "%s: bad segment alignment\n", path);
+        return -1;
+    }
+
+    img->entry = eh.e_entry;
+    img->phdr = phdr_address(&eh, phdrs);
+    img->phnum = eh.e_phnum;
+    return 0;
+}
+
+// Position-independent images get one PROT_NONE reservation covering the
+// whole segment span, aligned to the largest p_align, so the segments keep
+// their relative layout and nothing else can land in the gaps between
+// them. Returns the load bias to add to every link-time address.
+static uintptr_t reserve_span(const elf_image_t *img) {
+    size_t span = img->span_hi - img->span_lo;
+    size_t align = img->max_align;
+    size_t len = span + align - 0x1000;
+    void *p = mmap(NULL, len, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        die("mmap reserve");
+
+    uintptr_t start = (uintptr_t)p;
+    uintptr_t base = (start + align - 1) & ~(uintptr_t)(align - 1);
+    if (base > start)
+        munmap(p, base - start);
+    if (start + len > base + span)
+        munmap((void *)(base + span), start + len - (base + span));
+    return base - img->span_lo;
+}
+
+// Maps every segment of the plan from fd. The file only backs the
+// segment's file bytes; the rest of the last file page is cleared and
+// any further .bss pages are anonymous, as the kernel does. Returns the
+// load bias (0 for ET_EXEC).
+static uintptr_t map_image(const elf_image_t *img, int fd) {
+    int populate = (img->policy & LOADER_POLICY_POPULATE) ? MAP_POPULATE : 0;
+    uintptr_t bias = img->pie ? reserve_span(img) : 0;
+
+    for (int i = 0; i < img->nseg; i++) {
+        const elf_segment_t *sg = &img->seg[i];
+        uintptr_t seg_addr = bias + sg->addr;
+        size_t file_pages = PAGE_UP(sg->file_len);
+        size_t mem_pages = PAGE_UP(sg->mem_len);
+
+        if (sg->file_len > 0) {
+            void *addr = mmap((void *)seg_addr, file_pages, sg->prot,
+                              MAP_PRIVATE | MAP_FIXED | populate, fd, sg->offset);
+            if (addr == MAP_FAILED)
+                die("mmap segment");
+            if (img->policy & LOADER_POLICY_WILLNEED)
+                madvise(addr, file_pages, MADV_WILLNEED);
+            if ((img->policy & LOADER_POLICY_HUGETEXT) &&
+                (sg->prot & PROT_EXEC) && file_pages >= HUGE_TEXT_MIN)
+                madvise(addr, file_pages, MADV_HUGEPAGE);
+        }
+        if (sg->mem_len > sg->file_len && (sg->prot & PROT_WRITE) &&
+            file_pages > sg->file_len) {
+            memset((char *)seg_addr + sg->file_len, 0, file_pages - sg->file_len);
+        }
+        if (mem_pages > file_pages) {
+            void *addr = mmap((char *)seg_addr + file_pages, mem_pages - file_pages,
+                              sg->prot, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | populate,
+                              -1, 0);
+            if (addr == MAP_FAILED)
+                die("mmap bss");
+        }
+    }
+    return bias;
+}
+
+// Stack reservation: the binary's own request (PT_GNU_STACK p_memsz, as
+// set by -z stack-size) wins, otherwise RLIMIT_STACK like the kernel.
+static size_t stack_size_for(const elf_image_t *img) {
+    size_t size = img->stack_size;
+    if (size == 0) {
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+            size = rl.rlim_cur;
+        else
+            size = STACK_DEFAULT;
+    }
+    if (size < STACK_MIN)
+        size = STACK_MIN;
+    if (size > STACK_MAX)
+        size = STACK_MAX;
+    return PAGE_UP(size);
+}
+
+// Jumps to the program, or to its interpreter when interp is set. The
+// auxv always describes the main program; AT_BASE tells the interpreter
+// where it was itself loaded (0 for static programs, which relocate
+// themselves if they are static-pie).
+__attribute__((noreturn))
+static void start_image(const elf_image_t *img, uintptr_t bias,
+                        const elf_image_t *interp, uintptr_t interp_bias,
+                        const char *path, char *const argv[], const env_block_t *env) {
+    void *stack_top;
+    void *stack_base = map_stack(stack_size_for(img), img->stack_prot, &stack_top);
+
+    elf_info_t info = {
+        .phdr = img->phdr + bias,
+        .phnum = img->phnum,
+        .entry = img->entry + bias,
+        .base = interp ? interp_bias + interp->span_lo : 0,
+    };
+    build_initial_stack(stack_base, &stack_top, path, argv, env, &info);
+
+    uintptr_t entry = interp ? interp->entry + interp_bias : info.entry;
+    loader_trampoline((void *)entry, stack_top);
+    __builtin_unreachable();
+}
+
+// Parses "populate,willneed,hugetext" or "none" into *out. An unknown
+// word rejects the whole spec; it is reported if quiet is false.
+static bool parse_policy_flags(const char *spec, unsigned *out, bool quiet) {
+    unsigned flags = 0;
+    bool ok = true;
+    int words = 0;
+    char *copy = xstrdup(spec);
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        words++;
+        if (strcmp(tok, "populate") == 0) {
+            flags |= LOADER_POLICY_POPULATE;
+        } else if (strcmp(tok, "willneed") == 0) {
+            flags |= LOADER_POLICY_WILLNEED;
+        } else if (strcmp(tok, "hugetext") == 0) {
+            flags |= LOADER_POLICY_HUGETEXT;
+        } else if (strcmp(tok, "none") != 0) {
+            if (!quiet)
+                fprintf(stderr, "loader: unknown policy: %s (populate, willneed, hugetext, none)\n",
+                        tok);
+            ok = false;
+            break;
+        }
+    }
+    free(copy);
+    if (ok && words == 0) {
+        if (!quiet)
+            fprintf(stderr, "loader: empty policy (populate, willneed, hugetext, none)\n");
+        ok = false;
+    }
+    *out = ok ? flags : 0;
+    return ok;
+}
+
+// MINISHELL_LOADER_POLICY; a malformed value counts as none (and is
+// reported by `loader policy`).
+static unsigned default_policy(bool quiet) {
+    const char *env = getenv("MINISHELL_LOADER_POLICY");
+    unsigned flags = 0;
+    if (env)
+        parse_policy_flags(env, &flags, quiet);
+    return flags;
+}
+
+// Policy for a resolved path: an entry for the full path or the command's
+// basename, else MINISHELL_LOADER_POLICY, else nothing.
+static unsigned policy_for(const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    for (loader_policy_t *p = policies; p; p = p->next) {
+        if (strcmp(p->name, path) == 0 || strcmp(p->name, base) == 0)
+            return p->flags;
+    }
+    return default_policy(true);
+}
+
+// Finds, validates and opens img's program interpreter. A plan cached by
+// the parent is reused when the file still matches; otherwise the headers
+// are parsed into *scratch. Returns NULL (after reporting why) on failure.
+static const elf_image_t *open_interp(const elf_image_t *img, elf_image_t *scratch,
+                                      int *fd_out) {
+    int fd = open(img->interp, O_RDONLY);
+    if (fd < 0) {
+        perror(img->interp);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        for (elf_image_t *c = image_cache; c; c = c->next) {
+            if (same_file(c, &st)) {
+                *fd_out = fd;
+                return c;
+            }
+        }
+    }
+    if (parse_image(fd, img->interp, scratch, true) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if (!scratch->pie || scratch->interp[0]) {
+        fprintf(stderr, "%s: bad program interpreter\n", img->interp);
         close(fd);
+        return NULL;
+    }
+    scratch->policy = policy_for(img->interp);
+    *fd_out = fd;
+    return scratch;
+}
+
+// Maps the main image from fd (and its interpreter, if any) and starts it.
+__attribute__((noreturn))
+static void load_and_start(const elf_image_t *img, int fd, const char *path,
+                           char *const argv[], const env_block_t *env) {
+    const elf_image_t *interp = NULL;
+    elf_image_t interp_scratch;
+    int interp_fd = -1;
+    if (img->interp[0]) {
+        interp = open_interp(img, &interp_scratch, &interp_fd);
+        if (!interp)
+            _exit(127);
+    }
+
+    uintptr_t bias = map_image(img, fd);
+    close(fd);
+    uintptr_t interp_bias = 0;
+    if (interp) {
+        interp_bias = map_image(interp, interp_fd);
+        close(interp_fd);
+    }
+    start_image(img, bias, interp, interp_bias, path, argv, env);
+}
+
+int loader_run_elf(const char *path, char *const argv[], const env_block_t *env) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
         return 127;
     }
 
-    if (eh.e_phentsize != sizeof(Elf64_Phdr) || eh.e_phnum <= 0) {
-        fprintf(stderr, "%s: bad program headers\n", path);
+    elf_image_t img;
+    if (parse_image(fd, path, &img, true) < 0) {
         close(fd);
         return 127;
     }
+    img.policy = policy_for(path);
+    load_and_start(&img, fd, path, argv, env);
+}
 
-    Elf64_Phdr *phdrs = malloc(eh.e_phnum * sizeof(Elf64_Phdr));
-    if (!phdrs)
-        die("malloc phdrs");
+// Says why path has no plan (loader_prepare() returned NULL) without
+// running anything, for a caller that has to stay intact: exec.
+void loader_report(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return;
+    }
+    elf_image_t img;
+    if (parse_image(fd, path, &img, true) == 0)
+        fprintf(stderr, "%s: changed while being loaded\n", path);
+    close(fd);
+}
 
-    if (lseek(fd, eh.e_phoff, SEEK_SET) < 0)
-        die("lseek phdrs");
-    if (read(fd, phdrs, eh.e_phnum * sizeof(Elf64_Phdr)) !=
-        (ssize_t)(eh.e_phnum * sizeof(Elf64_Phdr)))
-        die("read phdrs");
+static elf_image_t *prepare_one(const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0)
+        return NULL;
 
-    for (int i = 0; i < eh.e_phnum; i++) {
-        if (phdrs[i].p_type == PT_INTERP) {
-            fprintf(stderr, "%s: dynamic executables not supported, use -static\n", path);
-            free(phdrs);
-            close(fd);
-            return 127;
+    elf_image_t **pp = &image_cache;
+    for (elf_image_t *img = image_cache; img; pp = &img->next, img = img->next) {
+        if (img->dev != st.st_dev || img->ino != st.st_ino)
+            continue;
+        if (same_file(img, &st)) {
+            // Most recently used first
+            *pp = img->next;
+            img->next = image_cache;
+            image_cache = img;
+            cache_hits++;
+            img->policy = policy_for(path);
+            return img;
         }
+        // Same inode, new contents: drop the stale plan.
+        *pp = img->next;
+        free(img);
+        image_count--;
+        break;
     }
 
-    for (int i = 0; i < eh.e_phnum; i++) {
-        Elf64_Phdr *ph = &phdrs[i];
-        if (ph->p_type != PT_LOAD)
-            continue;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    elf_image_t *img = xmalloc(sizeof(*img));
+    // Invalid files are left to loader_run_elf() so the child reports them.
+    if (parse_image(fd, path, img, false) < 0) {
+        close(fd);
+        free(img);
+        return NULL;
+    }
+    close(fd);
+    img->dev = st.st_dev;
+    img->ino = st.st_ino;
+    img->size = st.st_size;
+    img->mtime = st.st_mtim;
+    img->parse_ns = elapsed_ns(&t0);
+    img->policy = policy_for(path);
+    cache_misses++;
+    miss_ns_total += img->parse_ns;
+
+    if (image_count >= LOADER_CACHE_MAX) {
+        elf_image_t **last = &image_cache;
+        while ((*last)->next)
+            last = &(*last)->next;
+        free(*last);
+        *last = NULL;
+        image_count--;
+    }
+    img->next = image_cache;
+    image_cache = img;
+    image_count++;
+    return img;
+}
 
-        Elf64_Off off = ph->p_offset;
-        Elf64_Addr vaddr = ph->p_vaddr;
-        size_t filesz = ph->p_filesz;
-        size_t memsz = ph->p_memsz;
+const elf_image_t *loader_prepare(const char *path) {
+    elf_image_t *img = prepare_one(path);
+    // Keep the interpreter's plan warm as well; the child looks it up in
+    // the cache it inherits. A failure here is reported by the child.
+    if (img && img->interp[0])
+        prepare_one(img->interp);
+    return img;
+}
 
-        Elf64_Addr page = vaddr & ~(Elf64_Addr)(0xFFF);
-        Elf64_Addr page_off = vaddr - page;
-        size_t map_sz = page_off + memsz;
+int loader_exec_image(const elf_image_t *img, const char *path,
+                      char *const argv[], const env_block_t *env) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 127;
+    }
+    // The file may have been replaced since the parent validated it.
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !same_file(img, &st)) {
+        close(fd);
+        return loader_run_elf(path, argv, env);
+    }
+    load_and_start(img, fd, path, argv, env);
+}
 
-        int prot = 0;
-        if (ph->p_flags & PF_R) prot |= PROT_READ;
-        if (ph->p_flags & PF_W) prot |= PROT_WRITE;
-        if (ph->p_flags & PF_X) prot |= PROT_EXEC;
+// A plan holds no pointers a receiver needs (next only links the cache),
+// so it can be handed to a parked zygote as plain bytes.
+size_t loader_image_size(void) {
+    return sizeof(elf_image_t);
+}
 
-        void *addr = mmap((void *)page, map_sz, prot,
-                          MAP_PRIVATE | MAP_FIXED, fd, off - page_off);
-        if (addr == MAP_FAILED)
-            die("mmap segment");
+void loader_print_stats(void) {
+    long avg = cache_misses ? miss_ns_total / cache_misses : 0;
+    printf("loader: %d cached images, %ld hits, %ld misses\n",
+           image_count, cache_hits, cache_misses);
+    printf("loader: avg parse %ld us, est. time saved %ld us\n",
+           avg / 1000, (avg * cache_hits) / 1000);
+}
 
-        if (memsz > filesz) {
-            memset((char *)vaddr + filesz, 0, memsz - filesz);
-        }
+// Times build_initial_stack() alone for the current environment, on a
+// scratch stack the size of a default one. Used to compare stack setup
+// cost against environment size.
+void loader_bench_stack(int iterations) {
+    const env_block_t *env = envblock_get();
+    char *argv[] = {"bench", NULL};
+    elf_info_t info = {.phdr = 0, .phnum = 0, .entry = 0, .base = 0};
+    size_t size = STACK_DEFAULT;
+    void *top;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("loader: mmap");
+        return;
     }
 
-    free(phdrs);
-    close(fd);
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < iterations; i++) {
+        top = (char *)base + size;
+        build_initial_stack(base, &top, "/bench", argv, env, &info);
+    }
+    long ns = elapsed_ns(&t0);
+    munmap(base, size);
 
-    size_t stack_size = 8 * 1024 * 1024;
-    void *stack_top;
-    void *stack_base = map_stack(stack_size, &stack_top);
-    (void)stack_base;
+    printf("loader: env %d vars, %zu bytes: stack build %ld ns (%d runs)\n",
+           env->count, env->len, ns / iterations, iterations);
+}
 
-    build_initial_stack(stack_base, &stack_top, path, argv, envp);
+void loader_clear_cache(void) {
+    while (image_cache) {
+        elf_image_t *next = image_cache->next;
+        free(image_cache);
+        image_cache = next;
+    }
+    image_count = 0;
+}
 
-    loader_trampoline((void *)(uintptr_t)eh.e_entry, stack_top);
-    __builtin_unreachable();
+void loader_cleanup(void) {
+    loader_clear_cache();
+    while (policies) {
+        loader_policy_t *next = policies->next;
+        free(policies->name);
+        free(policies);
+        policies = next;
+    }
 }
 
+static void print_policy_flags(unsigned flags) {
+    if (!flags)
+        fputs(" none", stdout);
+    if (flags & LOADER_POLICY_POPULATE)
+        fputs(" populate", stdout);
+    if (flags & LOADER_POLICY_WILLNEED)
+        fputs(" willneed", stdout);
+    if (flags & LOADER_POLICY_HUGETEXT)
+        fputs(" hugetext", stdout);
+    fputc('\n', stdout);
+}
+
+// name == NULL lists the table; flags "none" (0) removes an entry.
+int loader_set_policy(const char *name, const char *spec) {
+    if (!name) {
+        unsigned flags = default_policy(false);
+        printf("default:");
+        print_policy_flags(flags);
+        for (loader_policy_t *p = policies; p; p = p->next) {
+            printf("%s:", p->name);
+            print_policy_flags(p->flags);
+        }
+        return 0;
+    }
 
+    unsigned flags;
+    if (!parse_policy_flags(spec, &flags, false))
+        return 1;
+
+    loader_policy_t **pp = &policies;
+    while (*pp && strcmp((*pp)->name, name) != 0)
+        pp = &(*pp)->next;
+    if (*pp && !flags) {
+        loader_policy_t *dead = *pp;
+        *pp = dead->next;
+        free(dead->name);
+        free(dead);
+    } else if (*pp) {
+        (*pp)->flags = flags;
+    } else if (flags) {
+        loader_policy_t *p = xmalloc(sizeof(*p));
+        p->name = xstrdup(name);
+        p->flags = flags;
+        p->next = policies;
+        policies = p;
+    }
+    return 0;
+}
 
+void loader_set_fault_report(bool on) {
+    report_faults = on;
+}
 
+void loader_report_faults(pid_t pid, const struct rusage *ru) {
+    if (!report_faults)
+        return;
+    fprintf(stderr, "[loader] pid %d: %ld minor, %ld major page faults\n",
+            (int)pid, ru->ru_minflt, ru->ru_majflt);
+}
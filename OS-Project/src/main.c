@@ -12,10 +12,13 @@
 static void repl(shell_state_t *sh) {
     char *line = NULL;
     size_t cap = 0;
+    char *pending = NULL;  // lines of a command not finished yet
+    arena_t arena = {0};  // everything parsed from the current line
 
     while (sh->running) {
-        jobs_reap(false);
+        jobs_notify();
 
+        prompt_continuation(pending != NULL);
         char *prompt = get_prompt();
         fputs(prompt, stdout);
         fflush(stdout);
@@ -27,67 +30,125 @@ static void repl(shell_state_t *sh) {
                 break;
             }
             if (errno == EINTR) {
+                // ^C drops a half-typed command too
                 clearerr(stdin);
+                free(pending);
+                pending = NULL;
                 continue;
             }
             perror("read_line_with_history");
             break;
         }
         if (n > 0 && line[n - 1] == '\n')
-            line[n - 1] = '\0';
+            line[--n] = '\0';
         
-        if (!line || !*line) {
+        if (!pending && (!line || !*line)) {
             continue;
         }
 
-        // Expand aliases
-        char *expanded = alias_expand(line);
-        const char *cmd_line = expanded ? expanded : line;
-
         // Add to history (before alias expansion for user visibility)
         history_add(line);
 
-        command_t *cmd = parse_line(cmd_line);
-        if (expanded) free(expanded);
-        if (!cmd)
-            continue;
-        sh->last_status = execute_commands(sh, cmd);
-        free_command_list(cmd);
+        char *text = line;
+        if (pending) {
+            size_t plen = strlen(pending);
+            text = xmalloc(plen + n + 2);
+            memcpy(text, pending, plen);
+            text[plen] = '\n';
+            memcpy(text + plen + 1, line, n + 1);
+            free(pending);
+            pending = NULL;
+        }
+
+        // Expand aliases
+        char *expanded = alias_expand(&arena, text);
+        const char *cmd_line = expanded ? expanded : text;
+
+        // An open if or loop, or a trailing | or &&: read more first
+        bool incomplete;
+        command_t *cmd = parse_text(&arena, cmd_line, &incomplete);
+        if (incomplete)
+            pending = text == line ? xstrdup(line) : text;
+        else if (text != line)
+            free(text);
+        if (cmd) {
+            input_sync();
+            sh->last_status = execute_commands(sh, cmd);
+        } else if (parse_failed()) {
+            execute_syntax_error(sh);
+        }
+        arena_reset(&arena);
     }
+    prompt_continuation(false);
+    arena_free(&arena);
+    free(pending);
     free(line);
     input_cleanup();
 }
 
+static void cleanup(void) {
+    // Queued background jobs would be lost with the shell
+    jobs_drain_queue();
+    aliases_cleanup();
+    history_cleanup();
+    pathcache_cleanup();
+    zygote_cleanup();
+    loader_cleanup();
+    envblock_cleanup();
+    jobs_cleanup();
+    cgroup_cleanup();
+    script_cleanup();
+}
+
 int main(int argc, char **argv) {
     shell_state_t sh;
     sh.last_status = 0;
     sh.running = true;
+    sh.tail_exec = false;
+    sh.pipe_size = 0;
+    sh.max_jobs = 0;
+    sh.loop_depth = 0;
+    sh.breaking = 0;
+    sh.continuing = false;
 
     signals_init();
+    input_init();
     jobs_init();
     history_init();
     aliases_init();
 
-    // If -c flag is provided, execute command and exit
+    // If -c flag is provided, execute command and exit; words after the
+    // string are $0, $1, ...
     if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        if (argc > 3)
+            params_set(argv[3], argc - 4, argv + 4);
         // Expand aliases for -c mode too
-        char *expanded = alias_expand(argv[2]);
+        arena_t arena = {0};
+        char *expanded = alias_expand(&arena, argv[2]);
         const char *cmd_line = expanded ? expanded : argv[2];
-        command_t *cmd = parse_line(cmd_line);
-        if (expanded) free(expanded);
+        command_t *cmd = parse_line(&arena, cmd_line);
         if (cmd) {
+            sh.tail_exec = true;
             sh.last_status = execute_commands(&sh, cmd);
-            free_command_list(cmd);
+        } else if (parse_failed()) {
+            execute_syntax_error(&sh);
         }
-        aliases_cleanup();
-        history_cleanup();
+        arena_free(&arena);
+        cleanup();
+        return sh.last_status;
+    }
+
+    // A script file: FILE [ARGS...]
+    if (argc > 1 && strcmp(argv[1], "-c") != 0) {
+        params_set(argv[1], argc - 2, argv + 2);
+        sh.last_status = script_run(&sh, argv[1], 0, NULL);
+        cleanup();
         return sh.last_status;
     }
 
     // Otherwise, run in interactive mode (continuous loop)
     repl(&sh);
-    aliases_cleanup();
-    history_cleanup();
+    cleanup();
     return sh.last_status;
 }
 
@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// parallel [-j N] [-v] CMD ARGS... [::: INPUT...]
+//
+// Runs CMD once per input, with every "{}" in its words replaced by the
+// input (or the input appended when there is no "{}"). Inputs come
+// after ":::" or, without one, one per line from stdin. At most N jobs
+// (default: online CPUs) run at once; they are launched like any other
+// command (zygote pool, loader) and reaped by the event loop.
+//
+// Each job's stdout goes to its own memfd, and the buffers are written
+// out strictly in input order as soon as every earlier job has finished,
+// so output never interleaves. stderr is not buffered. Failed jobs are
+// reported on stderr (every job with -v), followed by a summary line.
+// The status is the number of failed jobs, capped at 101.
+
+typedef struct task {
+    char  **argv;
+    int     out_fd;     // memfd holding the job's stdout
+    job_t  *job;        // while running
+    int     status;
+    bool    started;
+    bool    done;
+    struct timespec start, end;
+} task_t;
+
+typedef struct input_list {
+    char  **items;
+    int     count;
+    int     cap;
+} input_list_t;
+
+static void inputs_add(input_list_t *in, const char *s) {
+    if (in->count == in->cap) {
+        in->cap = in->cap ? in->cap * 2 : 16;
+        in->items = realloc(in->items, in->cap * sizeof(char *));
+        if (!in->items) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    in->items[in->count++] = xstrdup(s);
+}
+
+static void inputs_read(input_list_t *in, FILE *f) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, f)) != -1) {
+        if (n > 0 && line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (n > 0)
+            inputs_add(in, line);
+    }
+    free(line);
+}
+
+// word with every "{}" replaced by arg
+static char *substitute(const char *word, const char *arg, bool *used) {
+    size_t alen = strlen(arg);
+    size_t len = 0;
+    for (const char *p = word; *p; ) {
+        if (p[0] == '{' && p[1] == '}') {
+            len += alen;
+            p += 2;
+        } else {
+            len++;
+            p++;
+        }
+    }
+    char *out = xmalloc(len + 1);
+    char *o = out;
+    for (const char *p = word; *p; ) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(o, arg, alen);
+            o += alen;
+            p += 2;
+            *used = true;
+        } else {
+            *o++ = *p++;
+        }
+    }
+    *o = '\0';
+    return out;
+}
+
+static char **task_argv(char **tmpl, int ntmpl, const char *arg) {
+    char **argv = xmalloc((ntmpl + 2) * sizeof(char *));
+    bool used = false;
+    for (int i = 0; i < ntmpl; i++)
+        argv[i] = substitute(tmpl[i], arg, &used);
+    int n = ntmpl;
+    if (!used)
+        argv[n++] = xstrdup(arg);
+    argv[n] = NULL;
+    return argv;
+}
+
+static void free_argv(char **argv) {
+    for (int i = 0; argv[i]; i++)
+        free(argv[i]);
+    free(argv);
+}
+
+static double seconds_between(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static void task_describe(const task_t *t, char *buf, size_t len) {
+    size_t off = 0;
+    buf[0] = '\0';
+    for (int i = 0; t->argv[i] && off + 1 < len; i++)
+        off += snprintf(buf + off, len - off, "%s%s", i ? " " : "", t->argv[i]);
+}
+
+static bool task_start(task_t *t, int idx, int null_fd) {
+    char name[32];
+    snprintf(name, sizeof(name), "parallel-%d", idx);
+    t->out_fd = memfd_create(name, MFD_CLOEXEC);
+    if (t->out_fd < 0) {
+        perror("memfd_create");
+        return false;
+    }
+    command_t c = {.argv = t->argv};
+    t->job = job_create(&c, false);
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    pid_t pid = exec_launch(&c, null_fd, t->out_fd, job_cgroup_fd(t->job));
+    t->started = true;
+    if (pid < 0) {
+        job_wait(t->job);
+        t->job = NULL;
+        t->status = 127;
+        t->done = true;
+        t->end = t->start;
+        return true;
+    }
+    job_add_proc(t->job, pid, true);
+    timing_stage_add(&c, false, "process", pid);
+    return true;
+}
+
+// Writes a finished task's buffered stdout; returns its size.
+static off_t task_emit(task_t *t, int out_fd) {
+    struct stat st;
+    off_t size = (fstat(t->out_fd, &st) == 0) ? st.st_size : 0;
+    if (size > 0 && lseek(t->out_fd, 0, SEEK_SET) == 0 &&
+        copy_fd(t->out_fd, out_fd) < 0 && errno != EPIPE)
+        perror("parallel: write");
+    close(t->out_fd);
+    t->out_fd = -1;
+    return size;
+}
+
+static int parse_jobs(const char *s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (end == s || *end || n < 1 || n > 4096)
+        return -1;
+    return (int)n;
+}
+
+int parallel_run(command_t *cmd) {
+    char **argv = cmd->argv;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int slots = ncpu > 0 ? (int)ncpu : 1;
+    bool verbose = false;
+
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-j") == 0 && argv[i + 1]) {
+            slots = parse_jobs(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2]) {
+            slots = parse_jobs(argv[i] + 2);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else {
+            break;
+        }
+        if (slots < 0) {
+            fprintf(stderr, "parallel: bad job count\n");
+            return 1;
+        }
+    }
+    char **tmpl = &argv[i];
+    int ntmpl = 0;
+    while (tmpl[ntmpl] && strcmp(tmpl[ntmpl], ":::") != 0)
+        ntmpl++;
+    if (ntmpl == 0) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] [-v] CMD [ARGS...] [::: INPUT...]\n");
+        return 1;
+    }
+
+    input_list_t in = {0};
+    if (tmpl[ntmpl]) {
+        for (char **a = &tmpl[ntmpl + 1]; *a; a++)
+            inputs_add(&in, *a);
+    } else {
+        inputs_read(&in, stdin);
+    }
+
+    task_t *tasks = calloc(in.count ? in.count : 1, sizeof(task_t));
+    if (!tasks) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int k = 0; k < in.count; k++) {
+        tasks[k].argv = task_argv(tmpl, ntmpl, in.items[k]);
+        tasks[k].out_fd = -1;
+    }
+
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int out_fd = fileno(stdout);
+    fflush(stdout);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int next_start = 0, next_emit = 0, running = 0, failed = 0;
+    long long bytes = 0;
+    bool interrupted = false;
+
+    while (next_emit < in.count) {
+        while (!interrupted && running < slots && next_start < in.count) {
+            if (!task_start(&tasks[next_start], next_start, null_fd)) {
+                interrupted = true;
+                break;
+            }
+            if (!tasks[next_start].done)
+                running++;
+            next_start++;
+        }
+
+        // Reap, then write out everything that is now complete in order
+        for (int k = next_emit; k < next_start; k++) {
+            task_t *t = &tasks[k];
+            if (t->job && !job_running(t->job)) {
+                t->status = job_wait(t->job);
+                t->job = NULL;
+                t->done = true;
+                clock_gettime(CLOCK_MONOTONIC, &t->end);
+                running--;
+            }
+        }
+        while (next_emit < next_start && tasks[next_emit].done) {
+            task_t *t = &tasks[next_emit];
+            bytes += task_emit(t, out_fd);
+            if (t->status != 0)
+                failed++;
+            if (t->status != 0 || verbose) {
+                char desc[256];
+                task_describe(t, desc, sizeof(desc));
+                fprintf(stderr, "parallel: [%d] status %d, %.3fs: %s\n", next_emit + 1,
+                        t->status, seconds_between(&t->start, &t->end), desc);
+            }
+            next_emit++;
+        }
+        if (next_emit >= next_start && (interrupted || next_start >= in.count))
+            break;
+        if (running > 0 && jobs_dispatch(-1) < 0 && errno == EINTR && !interrupted) {
+            // Ctrl-C: stop starting jobs, end the running ones
+            interrupted = true;
+            for (int k = next_emit; k < next_start; k++) {
+                if (tasks[k].job && !tasks[k].done)
+                    kill(job_pgid(tasks[k].job), SIGTERM);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = seconds_between(&t0, &t1);
+    int skipped = in.count - next_emit;
+    fprintf(stderr, "parallel: %d jobs (%d failed%s), %d slots, %.3fs, %.1f jobs/s, %.1f MB output\n",
+            next_emit, failed, skipped ? ", rest cancelled" : "", slots, secs,
+            secs > 0 ? next_emit / secs : 0.0, bytes / (1024.0 * 1024.0));
+
+    for (int k = 0; k < in.count; k++) {
+        if (tasks[k].out_fd >= 0)
+            close(tasks[k].out_fd);
+        free_argv(tasks[k].argv);
+        free(in.items[k]);
+    }
+    free(tasks);
+    free(in.items);
+    if (null_fd >= 0)
+        close(null_fd);
+    if (interrupted)
+        return 128 + SIGINT;
+    return failed > 101 ? 101 : failed;
+}
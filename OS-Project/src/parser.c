@@ -1,111 +1,239 @@
+#define _GNU_SOURCE
 #include "shell.h"
 
-#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void free_redirs(redir_t *r) {
-    while (r) {
-        redir_t *next = r->next;
-        free(r->filename);
-        free(r);
-        r = next;
+// Deep copy of one pipeline (cmd and its next_pipe stages, not the
+// commands after it) into a, for running it after the line is gone.
+command_t *command_clone(const command_t *cmd, arena_t *a) {
+    command_t *head = NULL;
+    command_t **tail = &head;
+    for (const command_t *c = cmd; c; c = c->next_pipe) {
+        command_t *n = arena_zalloc(a, sizeof(*n));
+        size_t argc = 0;
+        while (c->argv[argc])
+            argc++;
+        n->argv = arena_alloc(a, (argc + 1) * sizeof(char *));
+        for (size_t i = 0; i < argc; i++)
+            n->argv[i] = arena_strdup(a, c->argv[i]);
+        n->argv[argc] = NULL;
+        if (c->word_params) {
+            n->word_params = arena_alloc(a, argc * sizeof(bool));
+            memcpy(n->word_params, c->word_params, argc * sizeof(bool));
+        }
+
+        redir_t **rt = &n->redirs;
+        for (const redir_t *r = c->redirs; r; r = r->next) {
+            redir_t *nr = arena_alloc(a, sizeof(*nr));
+            nr->type = r->type;
+            nr->filename = arena_strdup(a, r->filename);
+            nr->params = r->params;
+            nr->next = NULL;
+            *rt = nr;
+            rt = &nr->next;
+        }
+        n->background = c->background;
+        n->expanded = c->expanded;
+        n->arena = a;
+        *tail = n;
+        tail = &n->next_pipe;
     }
+    return head;
 }
 
-void free_command_list(command_t *cmd) {
-    while (cmd) {
-        command_t *next_seq = cmd->next_seq;
-        command_t *p = cmd;
-        while (p) {
-            command_t *next_pipe = p->next_pipe;
-            if (p->argv) {
-                for (size_t i = 0; p->argv[i]; i++)
-                    free(p->argv[i]);
-                free(p->argv);
-            }
-            free_redirs(p->redirs);
-            free(p);
-            p = next_pipe;
+// A copy of the command list cmd (every pipeline after it too) to run,
+// in a. Only the command nodes are copied: expansion gives the copy a
+// new argv and redirection list rather than changing the shared ones,
+// so a parsed script can be kept and run any number of times.
+command_t *command_instance(const command_t *cmd, arena_t *a) {
+    command_t *head = NULL;
+    command_t **seq_tail = &head;
+    for (const command_t *c = cmd; c; c = c->next_seq) {
+        command_t **pipe_tail = seq_tail;
+        for (const command_t *p = c; p; p = p->next_pipe) {
+            command_t *n = arena_alloc(a, sizeof(*n));
+            *n = *p;
+            n->next_pipe = n->next_seq = NULL;
+            n->expanded = false;
+            n->arena = a;
+            *pipe_tail = n;
+            pipe_tail = &n->next_pipe;
         }
-        cmd = next_seq;
+        seq_tail = &(*seq_tail)->next_seq;
     }
+    return head;
 }
 
-typedef struct vec {
-    char **data;
+// "cat a | grep b": the words of cmd, and of every later stage if
+// pipeline is set.
+char *command_text(const command_t *cmd, bool pipeline) {
+    size_t len = 1;
+    for (const command_t *c = cmd; c; c = pipeline ? c->next_pipe : NULL) {
+        for (int i = 0; c->argv[i]; i++)
+            len += strlen(c->argv[i]) + 1;
+        len += 3;
+    }
+    char *s = xmalloc(len);
+    char *p = s;
+    for (const command_t *c = cmd; c; c = pipeline ? c->next_pipe : NULL) {
+        if (c != cmd) {
+            memcpy(p, " | ", 3);
+            p += 3;
+        }
+        for (int i = 0; c->argv[i]; i++) {
+            if (i > 0)
+                *p++ = ' ';
+            size_t n = strlen(c->argv[i]);
+            memcpy(p, c->argv[i], n);
+            p += n;
+        }
+    }
+    *p = '\0';
+    return s;
+}
+
+static bool failed;  // see parse_failed()
+
+// Tokens under construction, grown inside the arena
+typedef struct token_vec {
+    token_t *data;
     size_t len;
     size_t cap;
-} vec_t;
-
-static void vec_init(vec_t *v) {
-    v->data = NULL;
-    v->len = v->cap = 0;
-}
+} token_vec_t;
 
-static void vec_push(vec_t *v, char *s) {
+static void token_push(arena_t *a, token_vec_t *v, token_type_t type, unsigned flags,
+                       size_t off, size_t len) {
     if (v->len + 1 > v->cap) {
-        size_t ncap = v->cap ? v->cap * 2 : 8;
-        char **nd = realloc(v->data, ncap * sizeof(char *));
-        if (!nd) {
-            perror("realloc");
-            exit(1);
-        }
-        v->data = nd;
+        size_t ncap = v->cap ? v->cap * 2 : 32;
+        v->data = arena_grow(a, v->data, v->cap * sizeof(token_t), ncap * sizeof(token_t));
         v->cap = ncap;
     }
-    v->data[v->len++] = s;
+    v->data[v->len++] = (token_t){type, flags, (uint32_t)off, (uint32_t)len};
 }
 
-static char *parse_word(const char **ps) {
-    const char *s = *ps;
-    char *buf = NULL;
-    size_t cap = 0, len = 0;
+// TOKEN_PARAMS if the n bytes at s refer to a parameter or variable
+static unsigned params_in(const char *s, size_t n) {
+    for (const char *p = memchr(s, '$', n); p; p = memchr(p + 1, '$', s + n - p - 1)) {
+        char c = p[1];
+        if ((c >= '0' && c <= '9') || c == '#' || c == '?' || c == '@' || c == '*' || c == '{' ||
+            c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            return TOKEN_PARAMS;
+    }
+    return 0;
+}
 
-    while (*s) {
-        if (isspace((unsigned char)*s) || *s == '|' || *s == '&' ||
-            *s == ';' || *s == '<' || *s == '>') {
-            break;
-        }
+// End of the word starting at s: plain runs are skipped with
+// scan_plain(), quoted parts up to their closing quote (or the end of
+// the line). Sets TOKEN_QUOTED in *flags if there is anything to
+// unquote, TOKEN_PARAMS if there are parameters outside single quotes.
+static const char *word_end(const char *s, unsigned *flags) {
+    for (;;) {
+        size_t n = scan_plain(s);
+        *flags |= params_in(s, n);
+        s += n;
         if (*s == '\\') {
+            *flags |= TOKEN_QUOTED;
             s++;
-            if (*s == '\0') break;
-            char c = *s++;
-            if (len + 2 > cap) {
-                size_t ncap = cap ? cap * 2 : 16;
-                char *nb = realloc(buf, ncap);
-                if (!nb) {
-                    perror("realloc");
-                    exit(1);
-                }
-                buf = nb;
-                cap = ncap;
-            }
-            buf[len++] = c;
-            continue;
+            if (*s)
+                s++;
         } else if (*s == '\'') {
-            s++;
-            while (*s && *s != '\'') {
-                if (len + 2 > cap) {
-                    size_t ncap = cap ? cap * 2 : 16;
-                    char *nb = realloc(buf, ncap);
-                    if (!nb) {
-                        perror("realloc");
-                        exit(1);
-                    }
-                    buf = nb;
-                    cap = ncap;
-                }
-                buf[len++] = *s++;
-            }
-            if (*s == '\'') s++;
-            continue;
+            *flags |= TOKEN_QUOTED;
+            s = strchrnul(s + 1, '\'');
+            if (*s)
+                s++;
         } else if (*s == '"') {
+            *flags |= TOKEN_QUOTED;
             s++;
             while (*s && *s != '"') {
-                char c = *s++;
-                if (c == '\\' && *s) {
+                n = strcspn(s, "\"\\");
+                *flags |= params_in(s, n);
+                s += n;
+                if (*s == '\\' && *++s)
+                    s++;
+            }
+            if (*s)
+                s++;
+        } else {
+            return s;  // whitespace, an operator or the end
+        }
+    }
+}
+
+// Splits line into tokens, ending with a TOK_END one, in an array from
+// a. Nothing is copied: words are (offset, length) slices of line.
+// Newlines are tokens of their own (they end commands, like `;`); a `#`
+// at the start of a word comments out the rest of its line. Returns the
+// number of tokens before TOK_END, or -1 if the line is too long to
+// describe that way.
+ssize_t tokenize(arena_t *a, const char *line, token_t **out) {
+    token_vec_t v = {0};
+    const char *s = line;
+
+    if (strlen(line) >= UINT32_MAX) {
+        fprintf(stderr, "syntax error: line too long\n");
+        return -1;
+    }
+    for (;;) {
+        while (scan_is(*s, SCAN_SPACE) && *s != '\n')
+            s++;
+        size_t off = s - line;
+        switch (*s) {
+            case '#':
+                s = strchrnul(s, '\n');
+                continue;
+            case '\0':
+                token_push(a, &v, TOK_END, 0, off, 0);
+                *out = v.data;
+                return v.len - 1;
+            case '\n': token_push(a, &v, TOK_NEWLINE, 0, off, 1); s++; continue;
+            case ';': token_push(a, &v, TOK_SEMI, 0, off, 1); s++; continue;
+            case '<': token_push(a, &v, TOK_IN, 0, off, 1); s++; continue;
+            case '|':
+            case '&':
+                if (s[1] == *s) {
+                    token_push(a, &v, *s == '|' ? TOK_OR : TOK_AND, 0, off, 2);
+                    s += 2;
+                } else {
+                    token_push(a, &v, *s == '|' ? TOK_PIPE : TOK_AMP, 0, off, 1);
+                    s++;
+                }
+                continue;
+            case '>':
+                if (s[1] == '>') {
+                    token_push(a, &v, TOK_APPEND, 0, off, 2);
+                    s += 2;
+                } else {
+                    token_push(a, &v, TOK_OUT, 0, off, 1);
+                    s++;
+                }
+                continue;
+        }
+        unsigned flags = 0;
+        s = word_end(s, &flags);
+        token_push(a, &v, TOK_WORD, flags, off, s - line - off);
+    }
+}
+
+// Removes the quotes and backslashes of the len bytes at w, in place
+// (the result is never longer), and NUL-terminates it.
+static char *unquote(char *w, size_t len) {
+    const char *s = w, *end = w + len;
+    char *d = w;
+    while (s < end) {
+        char c = *s++;
+        if (c == '\\') {
+            if (s < end)
+                *d++ = *s++;
+        } else if (c == '\'') {
+            while (s < end && *s != '\'')
+                *d++ = *s++;
+            if (s < end) s++;
+        } else if (c == '"') {
+            while (s < end && *s != '"') {
+                c = *s++;
+                if (c == '\\' && s < end) {
                     char esc = *s++;
                     switch (esc) {
                         case 'n': c = '\n'; break;
@@ -114,165 +242,409 @@ static char *parse_word(const char **ps) {
                         default: c = esc; break;
                     }
                 }
-                if (len + 2 > cap) {
-                    size_t ncap = cap ? cap * 2 : 16;
-                    char *nb = realloc(buf, ncap);
-                    if (!nb) {
-                        perror("realloc");
-                        exit(1);
-                    }
-                    buf = nb;
-                    cap = ncap;
-                }
-                buf[len++] = c;
+                *d++ = c;
             }
-            if (*s == '"') s++;
-            continue;
+            if (s < end) s++;
         } else {
-            if (len + 2 > cap) {
-                size_t ncap = cap ? cap * 2 : 16;
-                char *nb = realloc(buf, ncap);
-                if (!nb) {
-                    perror("realloc");
-                    exit(1);
-                }
-                buf = nb;
-                cap = ncap;
-            }
-            buf[len++] = *s++;
+            *d++ = c;
         }
     }
-    if (!buf) return NULL;
-    buf[len] = '\0';
-    *ps = s;
-    return buf;
+    *d = '\0';
+    return w;
 }
 
-static command_t *new_command(void) {
-    command_t *c = calloc(1, sizeof(*c));
-    if (!c) {
-        perror("calloc");
-        exit(1);
+// The word t as a string inside buf. Plain words only get a NUL where
+// the byte after them was (whitespace or an operator, already
+// tokenized); quoted ones are unquoted in place.
+static char *token_word(char *buf, const token_t *t) {
+    char *w = buf + t->off;
+    if (t->flags & TOKEN_QUOTED)
+        return unquote(w, t->len);
+    w[t->len] = '\0';
+    return w;
+}
+
+// ---- lists, pipelines and compound commands ----
+//
+// list      := pipeline { (&& | || | ; | & | newline) pipeline }
+// pipeline  := command { | command }
+// command   := simple | if | while | until | for
+// if        := if list then list { elif list then list } [else list] fi
+// while     := (while | until) list do list done
+// for       := for NAME [in WORD...] (; | newline) do list done
+//
+// Reserved words count only unquoted and where a command starts, so
+// `echo fi` is an ordinary command. Compound commands are parsed once:
+// loops run their body's nodes as often as they go round.
+
+typedef struct parser {
+    arena_t       *a;
+    char          *buf;         // the text, words NUL-terminated in place
+    const token_t *t;           // next token
+    bool           error;
+    bool           incomplete;  // the text ended inside a construct
+} parser_t;
+
+static const char *const reserved[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "do", "done", "for", NULL,
+};
+
+static const char *token_name(parser_t *p, const token_t *t) {
+    switch (t->type) {
+        case TOK_WORD: return token_word(p->buf, t);
+        case TOK_PIPE: return "|";
+        case TOK_AMP: return "&";
+        case TOK_SEMI: return ";";
+        case TOK_AND: return "&&";
+        case TOK_OR: return "||";
+        case TOK_IN: return "<";
+        case TOK_OUT: return ">";
+        case TOK_APPEND: return ">>";
+        default: return "newline";
     }
-    return c;
 }
 
-command_t *parse_line(const char *line) {
-    const char *s = line;
-    command_t *seq_head = NULL;
-    command_t *seq_tail = NULL;
+static bool is_word(const parser_t *p, const token_t *t, const char *word) {
+    size_t n = strlen(word);
+    return t->type == TOK_WORD && !(t->flags & TOKEN_QUOTED) && t->len == n &&
+           memcmp(p->buf + t->off, word, n) == 0;
+}
 
-    while (*s) {
-        while (isspace((unsigned char)*s))
-            s++;
-        if (!*s)
-            break;
+static bool at_any(const parser_t *p, const char *const *words) {
+    for (; words && *words; words++) {
+        if (is_word(p, p->t, *words))
+            return true;
+    }
+    return false;
+}
 
-        command_t *first_in_pipeline = NULL;
-        command_t *last_in_pipeline = NULL;
+// Reports the unexpected token at p->t; running out of text instead is
+// left to the caller, who may have more to come.
+static command_t *syntax_error(parser_t *p) {
+    if (p->t->type == TOK_END)
+        p->incomplete = true;
+    else if (!p->error)
+        fprintf(stderr, "syntax error near unexpected token `%s'\n", token_name(p, p->t));
+    p->error = true;
+    return NULL;
+}
 
-        for (;;) {
-            command_t *cmd = new_command();
-            vec_t args;
-            vec_init(&args);
+static void skip_newlines(parser_t *p) {
+    while (p->t->type == TOK_NEWLINE)
+        p->t++;
+}
 
-            while (*s && !strchr("|;&", *s)) {
-                while (isspace((unsigned char)*s))
-                    s++;
-                if (!*s || strchr("|;&", *s))
-                    break;
-                if (*s == '<' || *s == '>') {
-                    redir_type_t rtype;
-                    if (*s == '<') {
-                        rtype = REDIR_IN;
-                        s++;
-                    } else {
-                        s++;
-                        if (*s == '>') {
-                            rtype = REDIR_APPEND;
-                            s++;
-                        } else {
-                            rtype = REDIR_OUT;
-                        }
-                    }
-                    while (isspace((unsigned char)*s))
-                        s++;
-                    char *fname = parse_word(&s);
-                    if (!fname) {
-                        fprintf(stderr, "syntax error: missing filename after redirection\n");
-                        free_command_list(cmd);
-                        free_command_list(first_in_pipeline);
-                        free_command_list(seq_head);
-                        return NULL;
-                    }
-                    redir_t *r = calloc(1, sizeof(*r));
-                    if (!r) {
-                        perror("calloc");
-                        exit(1);
-                    }
-                    r->type = rtype;
-                    r->filename = fname;
-                    r->next = cmd->redirs;
-                    cmd->redirs = r;
-                    continue;
-                } else {
-                    char *w = parse_word(&s);
-                    if (w)
-                        vec_push(&args, w);
-                }
-            }
+static bool ends_stage(token_type_t type) {
+    return type != TOK_WORD && type != TOK_IN && type != TOK_OUT && type != TOK_APPEND;
+}
 
-            if (args.len == 0) {
-                free(cmd);
-            } else {
-                vec_push(&args, NULL);
-                cmd->argv = args.data;
-
-                if (!first_in_pipeline)
-                    first_in_pipeline = cmd;
-                else
-                    last_in_pipeline->next_pipe = cmd;
-                last_in_pipeline = cmd;
-            }
+static command_t *new_command(arena_t *a) {
+    command_t *c = arena_zalloc(a, sizeof(*c));
+    c->arena = a;
+    return c;
+}
 
-            while (isspace((unsigned char)*s))
-                s++;
-            if (*s == '|') {
-                s++;
-                continue;
-            }
-            break;
-        }
+static command_t *parse_list(parser_t *p, const char *const *stops);
 
-        if (!first_in_pipeline) {
+// A simple command; NULL (and no error) if it has no words.
+static command_t *parse_simple(parser_t *p) {
+    arena_t *a = p->a;
+    command_t *cmd = new_command(a);
+    size_t argc = 0;
+    for (const token_t *u = p->t; !ends_stage(u->type); u++) {
+        if (u->type == TOK_WORD)
+            argc++;
+        else if (u[1].type == TOK_WORD)
+            u++;  // a redirection's file name
+    }
+    char **argv = arena_alloc(a, (argc + 1) * sizeof(char *));
+    size_t nwords = argc;
+    argc = 0;
+
+    for (const token_t *t = p->t; !ends_stage(t->type); t = ++p->t) {
+        if (t->type == TOK_WORD) {
+            if ((t->flags & TOKEN_PARAMS) && !cmd->word_params)
+                cmd->word_params = arena_zalloc(a, nwords * sizeof(bool));
+            if (t->flags & TOKEN_PARAMS)
+                cmd->word_params[argc] = true;
+            argv[argc++] = token_word(p->buf, t);
             continue;
         }
-
-        bool background = false;
-        while (isspace((unsigned char)*s))
-            s++;
-        if (*s == '&') {
-            background = true;
-            s++;
+        redir_type_t rtype = t->type == TOK_IN  ? REDIR_IN
+                             : t->type == TOK_OUT ? REDIR_OUT
+                                                  : REDIR_APPEND;
+        if (t[1].type != TOK_WORD) {
+            fprintf(stderr, "syntax error: missing filename after redirection\n");
+            p->error = true;
+            return NULL;
         }
-        while (isspace((unsigned char)*s))
-            s++;
-        if (*s == ';')
-            s++;
+        t = ++p->t;
+        redir_t *r = arena_alloc(a, sizeof(*r));
+        r->type = rtype;
+        r->filename = token_word(p->buf, t);
+        r->params = t->flags & TOKEN_PARAMS;
+        r->next = cmd->redirs;
+        cmd->redirs = r;
+    }
+    if (argc == 0)
+        return NULL;
+    argv[argc] = NULL;
+    cmd->argv = argv;
+    return cmd;
+}
+
+// A list that must end at one of stops (consumed) and not be empty.
+static command_t *parse_part(parser_t *p, const char *const *stops) {
+    command_t *list = parse_list(p, stops);
+    if (p->error)
+        return NULL;
+    if (!list)
+        return syntax_error(p);
+    p->t++;
+    return list;
+}
 
-        for (command_t *p = first_in_pipeline; p; p = p->next_pipe)
-            p->background = background;
+// if/elif: an elif is an if nested in the else part that shares its fi.
+static command_t *parse_if(parser_t *p) {
+    static const char *const then_stops[] = {"then", NULL};
+    static const char *const body_stops[] = {"elif", "else", "fi", NULL};
+    static const char *const fi_stops[] = {"fi", NULL};
 
-        if (!seq_head)
-            seq_head = first_in_pipeline;
-        else
-            seq_tail->next_seq = first_in_pipeline;
-        seq_tail = first_in_pipeline;
+    command_t *c = new_command(p->a);
+    c->kind = CMD_IF;
+    p->t++;
+    if (!(c->cond = parse_part(p, then_stops)))
+        return NULL;
+    c->body = parse_list(p, body_stops);
+    if (p->error)
+        return NULL;
+    if (!c->body)
+        return syntax_error(p);
+    if (is_word(p, p->t, "elif")) {
+        c->else_part = parse_if(p);
+    } else if (is_word(p, p->t, "else")) {
+        p->t++;
+        c->else_part = parse_part(p, fi_stops);
+    } else {
+        p->t++;  // fi
     }
+    return p->error ? NULL : c;
+}
+
+static const char *const do_stops[] = {"do", NULL};
+static const char *const done_stops[] = {"done", NULL};
+
+static command_t *parse_loop(parser_t *p, command_kind_t kind) {
+    command_t *c = new_command(p->a);
+    c->kind = kind;
+    p->t++;
+    if (!(c->cond = parse_part(p, do_stops)) || !(c->body = parse_part(p, done_stops)))
+        return NULL;
+    return c;
+}
+
+static bool valid_name(const char *s) {
+    if (!(*s == '_' || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')))
+        return false;
+    while (*++s) {
+        if (!(*s == '_' || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+              (*s >= '0' && *s <= '9')))
+            return false;
+    }
+    return true;
+}
+
+// for NAME [in WORD...]: argv is NAME and the words, "$@" without `in`.
+static command_t *parse_for(parser_t *p) {
+    arena_t *a = p->a;
+    const token_t *name = ++p->t;
+    if (name->type != TOK_WORD)
+        return syntax_error(p);
+    char *var = token_word(p->buf, name);
+    if ((name->flags & TOKEN_QUOTED) || !valid_name(var)) {
+        fprintf(stderr, "syntax error: `%s': not a valid identifier\n", var);
+        p->error = true;
+        return NULL;
+    }
+    p->t++;
+    skip_newlines(p);
+
+    char **argv;
+    bool *params = NULL;
+    if (is_word(p, p->t, "in")) {
+        const token_t *w = ++p->t;
+        size_t n = 0;
+        while (w[n].type == TOK_WORD)
+            n++;
+        argv = arena_alloc(a, (n + 2) * sizeof(char *));
+        for (size_t i = 0; i < n; i++, p->t++) {
+            if ((w[i].flags & TOKEN_PARAMS) && !params)
+                params = arena_zalloc(a, (n + 1) * sizeof(bool));
+            if (w[i].flags & TOKEN_PARAMS)
+                params[i + 1] = true;
+            argv[i + 1] = token_word(p->buf, &w[i]);
+        }
+        argv[n + 1] = NULL;
+        if (p->t->type != TOK_SEMI && p->t->type != TOK_NEWLINE)
+            return syntax_error(p);
+    } else {
+        argv = arena_alloc(a, 3 * sizeof(char *));
+        argv[1] = arena_strdup(a, "$@");
+        argv[2] = NULL;
+        params = arena_zalloc(a, 2 * sizeof(bool));
+        params[1] = true;
+    }
+    argv[0] = var;
+    if (p->t->type == TOK_SEMI)
+        p->t++;
+    skip_newlines(p);
+    if (!is_word(p, p->t, "do"))
+        return syntax_error(p);
+    p->t++;
+
+    command_t *c = new_command(a);
+    c->kind = CMD_FOR;
+    c->argv = argv;
+    c->word_params = params;
+    if (!(c->body = parse_part(p, done_stops)))
+        return NULL;
+    return c;
+}
 
-    return seq_head;
+static command_t *parse_command(parser_t *p) {
+    if (ends_stage(p->t->type))
+        return syntax_error(p);
+    if (is_word(p, p->t, "if"))
+        return parse_if(p);
+    if (is_word(p, p->t, "while"))
+        return parse_loop(p, CMD_WHILE);
+    if (is_word(p, p->t, "until"))
+        return parse_loop(p, CMD_UNTIL);
+    if (is_word(p, p->t, "for"))
+        return parse_for(p);
+    if (at_any(p, reserved))
+        return syntax_error(p);
+    return parse_simple(p);
 }
 
+// Stages without words are dropped; a pipeline of none is NULL.
+static command_t *parse_pipeline(parser_t *p) {
+    command_t *head = NULL, *tail = NULL;
+    for (;;) {
+        command_t *c = parse_command(p);
+        if (p->error)
+            return NULL;
+        if (c && c->kind != CMD_SIMPLE && (head || p->t->type == TOK_PIPE)) {
+            fprintf(stderr, "syntax error: compound commands cannot be piped\n");
+            p->error = true;
+            return NULL;
+        }
+        if (c) {
+            if (!head)
+                head = c;
+            else
+                tail->next_pipe = c;
+            tail = c;
+        }
+        if (p->t->type != TOK_PIPE)
+            return head;
+        p->t++;
+        skip_newlines(p);
+    }
+}
+
+// Pipelines up to the end of the text or, for the part of a compound
+// command, up to one of the reserved words stops (left unconsumed).
+static command_t *parse_list(parser_t *p, const char *const *stops) {
+    command_t *head = NULL, *tail = NULL;
+    bool more = false;  // after && or ||, a pipeline must follow
+
+    for (;;) {
+        skip_newlines(p);
+        if (p->t->type == TOK_END && !stops && !more)
+            return head;
+        if (at_any(p, stops) && !more)
+            return head;
+        command_t *pl = parse_pipeline(p);
+        if (p->error)
+            return NULL;
+
+        command_next_t next_if = NEXT_ALWAYS;
+        more = false;
+        switch (p->t->type) {
+            case TOK_AND:
+            case TOK_OR:
+                next_if = p->t->type == TOK_AND ? NEXT_AND : NEXT_OR;
+                more = true;
+                p->t++;
+                break;
+            case TOK_AMP:
+                if (pl && pl->kind != CMD_SIMPLE) {
+                    fprintf(stderr, "syntax error: compound commands cannot run in the background\n");
+                    p->error = true;
+                    return NULL;
+                }
+                for (command_t *c = pl; c; c = c->next_pipe)
+                    c->background = true;
+                if ((++p->t)->type == TOK_SEMI)
+                    p->t++;
+                break;
+            case TOK_SEMI:
+            case TOK_NEWLINE:
+                p->t++;
+                break;
+            case TOK_END:
+                break;
+            default:
+                // after a compound command: only the end of an outer one
+                if (!at_any(p, stops))
+                    return syntax_error(p);
+                break;
+        }
+        if (!pl)
+            continue;
+        pl->next_if = next_if;
+        if (!head)
+            head = pl;
+        else
+            tail->next_seq = pl;
+        tail = pl;
+    }
+}
 
+// Parses text (one line, or several for compound commands) into a list
+// of pipelines, all of it allocated from a: the caller drops the whole
+// list with arena_reset(a). The text is copied into a once; argv
+// strings and file names point into that copy. If the text stops in the
+// middle of a command (an open if or loop, a trailing | or &&), returns
+// NULL and sets *incomplete, so the caller can read more and try again;
+// without incomplete, that is a syntax error.
+command_t *parse_text(arena_t *a, const char *text, bool *incomplete) {
+    parser_t p = {.a = a, .buf = arena_strdup(a, text)};
+    token_t *toks;
+    if (incomplete)
+        *incomplete = false;
+    failed = true;
+    if (tokenize(a, p.buf, &toks) < 0)
+        return NULL;
+    p.t = toks;
+    command_t *cmd = parse_list(&p, NULL);
+    failed = p.error && !(p.incomplete && incomplete);
+    if (!p.error)
+        return cmd;
+    if (p.incomplete && incomplete)
+        *incomplete = true;
+    else if (p.incomplete)
+        fprintf(stderr, "syntax error: unexpected end of input\n");
+    return NULL;
+}
 
+// Whether the last parse_text() (or parse_line()) call hit a syntax
+// error, as opposed to text with no commands in it or an unfinished one.
+bool parse_failed(void) {
+    return failed;
+}
 
+command_t *parse_line(arena_t *a, const char *line) {
+    return parse_text(a, line, NULL);
+}
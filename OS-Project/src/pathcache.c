@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Command location cache (bash-style "hash" table).
+//
+// The shell resolves external command names against PATH in the parent
+// and remembers the result, including "not found", so repeated launches
+// of the same tool skip the PATH walk. The PATH directories' mtimes are
+// checked once per generation (a command line; see pathcache_new_generation())
+// at the first lookup in it, not at every lookup: a hit costs no system
+// call. A changed directory only drops the answers it could have changed.
+
+#define PATHCACHE_BUCKETS 64
+
+typedef struct path_dir {
+    char           *dir;
+    bool            absolute;
+    struct timespec mtime;
+    bool            exists;
+} path_dir_t;
+
+typedef struct path_entry {
+    char   *name;
+    char   *path;       // NULL for a cached "not found"
+    int     dir_index;  // index into dirs[] where name was found
+    long    hits;
+    struct path_entry *next;
+} path_entry_t;
+
+static path_entry_t *buckets[PATHCACHE_BUCKETS];
+static path_dir_t   *dirs = NULL;
+static int           dir_count = 0;
+static char         *cached_path = NULL;
+static bool          path_has_relative = false;
+static unsigned long generation = 1;  // bumped for every command line
+static unsigned long checked;         // generation the mtimes were checked in
+
+static unsigned hash_name(const char *s) {
+    unsigned h = 5381;
+    while (*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h % PATHCACHE_BUCKETS;
+}
+
+static void stat_dir(path_dir_t *d) {
+    struct stat st;
+    if (stat(d->dir, &st) == 0) {
+        d->exists = true;
+        d->mtime = st.st_mtim;
+    } else {
+        d->exists = false;
+        d->mtime.tv_sec = 0;
+        d->mtime.tv_nsec = 0;
+    }
+}
+
+// Returns true if dirs[i]'s mtime no longer matches what was recorded.
+static bool dir_changed(int i) {
+    path_dir_t *d = &dirs[i];
+    struct stat st;
+    if (stat(d->dir, &st) != 0)
+        return d->exists;
+    if (!d->exists)
+        return true;
+    return st.st_mtim.tv_sec != d->mtime.tv_sec ||
+           st.st_mtim.tv_nsec != d->mtime.tv_nsec;
+}
+
+static void clear_entries(void) {
+    for (int i = 0; i < PATHCACHE_BUCKETS; i++) {
+        path_entry_t *e = buckets[i];
+        while (e) {
+            path_entry_t *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+}
+
+static void free_dirs(void) {
+    for (int i = 0; i < dir_count; i++)
+        free(dirs[i].dir);
+    free(dirs);
+    dirs = NULL;
+    dir_count = 0;
+    free(cached_path);
+    cached_path = NULL;
+    path_has_relative = false;
+}
+
+static void load_dirs(const char *path) {
+    free_dirs();
+    cached_path = xstrdup(path);
+
+    int n = 1;
+    for (const char *p = path; *p; p++)
+        if (*p == ':')
+            n++;
+    dirs = xmalloc(n * sizeof(*dirs));
+
+    char *copy = xstrdup(path);
+    char *save = NULL;
+    for (char *dir = strtok_r(copy, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+        path_dir_t *d = &dirs[dir_count++];
+        d->dir = xstrdup(dir);
+        d->absolute = (dir[0] == '/');
+        if (!d->absolute)
+            path_has_relative = true;
+        stat_dir(d);
+    }
+    free(copy);
+}
+
+static const char *current_path(void) {
+    const char *path = getenv("PATH");
+    return path ? path : "/bin:/usr/bin";
+}
+
+// Makes sure dirs[] describes the current PATH. The table is flushed
+// whenever PATH itself changed, whether through export/unset or not.
+static void sync_path(void) {
+    const char *path = current_path();
+    if (!cached_path || strcmp(cached_path, path) != 0) {
+        clear_entries();
+        load_dirs(path);
+    }
+}
+
+// Drops the entries a change in dirs[first] (or later) could affect: a
+// found entry can only be shadowed by a change in an earlier (or the
+// same) directory, and a miss by any of them.
+static void drop_entries_from(int first) {
+    for (int i = 0; i < PATHCACHE_BUCKETS; i++) {
+        path_entry_t **pp = &buckets[i];
+        while (*pp) {
+            path_entry_t *e = *pp;
+            if (e->path && e->dir_index < first) {
+                pp = &e->next;
+                continue;
+            }
+            *pp = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+}
+
+// Once per generation: one stat() per PATH directory.
+static void revalidate(void) {
+    int first = -1;
+    for (int i = 0; i < dir_count; i++) {
+        if (dir_changed(i)) {
+            if (first < 0)
+                first = i;
+            stat_dir(&dirs[i]);
+        }
+    }
+    if (first >= 0)
+        drop_entries_from(first);
+    checked = generation;
+}
+
+// A new command line: directories may have changed since the last one.
+void pathcache_new_generation(void) {
+    generation++;
+}
+
+static path_entry_t *find_entry(const char *name, unsigned h) {
+    for (path_entry_t *e = buckets[h]; e; e = e->next) {
+        if (strcmp(e->name, name) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// Walks PATH for name. Returns the full path (caller frees) or NULL, and
+// the index of the directory it was found in through *dir_index.
+static char *resolve(const char *name, int *dir_index) {
+    *dir_index = -1;
+    for (int i = 0; i < dir_count; i++) {
+        size_t len = strlen(dirs[i].dir) + 1 + strlen(name) + 1;
+        char *full = xmalloc(len);
+        snprintf(full, len, "%s/%s", dirs[i].dir, name);
+        if (access(full, X_OK) == 0) {
+            *dir_index = i;
+            return full;
+        }
+        free(full);
+    }
+    return NULL;
+}
+
+char *pathcache_lookup(const char *name) {
+    if (strchr(name, '/'))
+        return xstrdup(name);
+
+    sync_path();
+    if (checked != generation)
+        revalidate();
+    unsigned h = hash_name(name);
+    path_entry_t *e = find_entry(name, h);
+    if (e) {
+        e->hits++;
+        return xstrdup(e->path);
+    }
+
+    int dir_index;
+    char *found = resolve(name, &dir_index);
+
+    // Results that depend on a relative PATH component would go stale on
+    // every cd, so they are returned but never remembered.
+    bool cacheable = found ? dirs[dir_index].absolute : !path_has_relative;
+    if (!cacheable)
+        return found;
+
+    e = xmalloc(sizeof(*e));
+    e->name = xstrdup(name);
+    e->path = found;
+    e->dir_index = dir_index;
+    e->hits = 1;
+    e->next = buckets[h];
+    buckets[h] = e;
+    return xstrdup(found);
+}
+
+void pathcache_clear(void) {
+    clear_entries();
+    free_dirs();
+}
+
+void pathcache_print(void) {
+    bool any = false;
+    for (int i = 0; i < PATHCACHE_BUCKETS; i++) {
+        for (path_entry_t *e = buckets[i]; e; e = e->next) {
+            if (!any) {
+                printf("hits\tcommand\n");
+                any = true;
+            }
+            if (e->path)
+                printf("%4ld\t%s\n", e->hits, e->path);
+            else
+                printf("%4ld\t%s (not found)\n", e->hits, e->name);
+        }
+    }
+    if (!any)
+        printf("hash: hash table empty\n");
+}
+
+void pathcache_cleanup(void) {
+    pathcache_clear();
+}
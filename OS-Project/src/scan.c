@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Tokenizer scanning.
+//
+// Most of a command line is runs of plain word bytes: anything but
+// whitespace, quotes, a backslash, an operator (| & ; < >) or the
+// terminating NUL. scan_plain() measures such a run so the parser can
+// copy it in one go. On x86 it classifies 16 (SSE2) or 32 (AVX2) bytes
+// per step into a bitmask of special bytes and stops at the lowest set
+// bit; the implementation is picked once from the CPU, and
+// MINISHELL_SCAN=scalar|sse2|avx2 overrides it (for benchmarking).
+//
+// Vector loads are aligned, so they never touch a page the string does
+// not reach; bytes before the start of the string are masked off.
+
+const unsigned char scan_class[256] = {
+    ['\0'] = SCAN_END,
+    [' '] = SCAN_SPACE, ['\t'] = SCAN_SPACE, ['\n'] = SCAN_SPACE,
+    ['\v'] = SCAN_SPACE, ['\f'] = SCAN_SPACE, ['\r'] = SCAN_SPACE,
+    ['\''] = SCAN_QUOTE, ['"'] = SCAN_QUOTE, ['\\'] = SCAN_QUOTE,
+    ['|'] = SCAN_OP, ['&'] = SCAN_OP, [';'] = SCAN_OP,
+    ['<'] = SCAN_REDIR, ['>'] = SCAN_REDIR,
+};
+
+static size_t scan_plain_scalar(const char *s) {
+    const unsigned char *p = (const unsigned char *)s;
+    while (!scan_class[*p])
+        p++;
+    return p - (const unsigned char *)s;
+}
+
+#ifdef SCAN_X86
+
+static inline unsigned special_mask_sse2(__m128i v) {
+    // \t \n \v \f \r: 9..13, i.e. (c - 9) <= 4 unsigned
+    __m128i ctl = _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, _mm_set1_epi8(9)),
+                                               _mm_set1_epi8(4)),
+                                 _mm_setzero_si128());
+    __m128i m = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    return (unsigned)_mm_movemask_epi8(m);
+}
+
+// The aligned loads may read a few bytes before s or past its NUL,
+// always inside the same aligned block.
+__attribute__((no_sanitize_address))
+static size_t scan_plain_sse2(const char *s) {
+    uintptr_t off = (uintptr_t)s & 15;
+    const char *p = s - off;
+    unsigned mask = special_mask_sse2(_mm_load_si128((const __m128i *)p)) >> off;
+    if (mask)
+        return __builtin_ctz(mask);
+    for (;;) {
+        p += 16;
+        mask = special_mask_sse2(_mm_load_si128((const __m128i *)p));
+        if (mask)
+            return (p - s) + __builtin_ctz(mask);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t special_mask_avx2(__m256i v) {
+    __m256i ctl = _mm256_cmpeq_epi8(_mm256_subs_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(9)),
+                                                     _mm256_set1_epi8(4)),
+                                    _mm256_setzero_si256());
+    __m256i m = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+    return (uint32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static size_t scan_plain_avx2(const char *s) {
+    uintptr_t off = (uintptr_t)s & 31;
+    const char *p = s - off;
+    uint32_t mask = special_mask_avx2(_mm256_load_si256((const __m256i *)p)) >> off;
+    if (mask)
+        return __builtin_ctz(mask);
+    for (;;) {
+        p += 32;
+        mask = special_mask_avx2(_mm256_load_si256((const __m256i *)p));
+        if (mask)
+            return (p - s) + __builtin_ctz(mask);
+    }
+}
+
+#endif
+
+typedef struct scan_impl {
+    const char *name;
+    size_t (*plain)(const char *s);
+} scan_impl_t;
+
+static const scan_impl_t impls[] = {
+    {"scalar", scan_plain_scalar},
+#ifdef SCAN_X86
+    {"sse2", scan_plain_sse2},
+    {"avx2", scan_plain_avx2},
+#endif
+};
+
+static const scan_impl_t *impl = NULL;
+
+static bool impl_supported(const scan_impl_t *i) {
+#ifdef SCAN_X86
+    if (i->plain == scan_plain_avx2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    (void)i;
+    return true;
+}
+
+// Selects an implementation by name; NULL picks the best one the CPU
+// has. Returns false for an unknown or unsupported name.
+bool scan_select(const char *name) {
+    const scan_impl_t *best = NULL;
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        if (!impl_supported(&impls[k]))
+            continue;
+        if (name ? strcmp(name, impls[k].name) == 0 : true)
+            best = &impls[k];
+    }
+    if (!best)
+        return false;
+    impl = best;
+    return true;
+}
+
+const char *scan_impl_name(void) {
+    if (!impl)
+        scan_plain("");
+    return impl->name;
+}
+
+// Length of the run of plain word bytes at s.
+size_t scan_plain(const char *s) {
+    if (!impl) {
+#ifdef SCAN_X86
+        __builtin_cpu_init();
+#endif
+        const char *env = getenv("MINISHELL_SCAN");
+        if (!env || !scan_select(env))
+            scan_select(NULL);
+    }
+    return impl->plain(s);
+}
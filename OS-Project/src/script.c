@@ -0,0 +1,783 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Script files and parameters.
+//
+// `minishell_noexec FILE [ARGS...]` and `source FILE [ARGS...]` read the
+// file a line (or a compound command's lines) at a time, parse each one
+// into the script's own arena and run a copy of it (command_instance()),
+// so the parsed lines stay intact. Once the whole file has been read
+// the parsed script is kept: in memory, for sourcing it again in the
+// same shell, and on disk in the per-user cache directory
+// ($XDG_CACHE_HOME/minishell, or ~/.cache/minishell) as DEV-INO.mshc, so
+// that the next shell that runs it loads the commands instead of parsing
+// them. Both are keyed by the file's device, inode, size and mtime; a
+// changed script is parsed again. A cache file is only loaded if it is
+// ours (or the script owner's) and nobody else can write to it or to
+// the directory. MINISHELL_SCRIPT_CACHE=0 turns the on-disk
+// cache off.
+//
+// Aliases are applied before parsing, so a line whose first word is an
+// alias is parsed from its text whenever it runs.
+
+#define SCRIPT_MAX_DEPTH 64
+#define CACHE_MAGIC      "MSHC"
+#define CACHE_VERSION    2
+
+// $0, $1... of the running script (or of the -c string)
+typedef struct params {
+    const char *name;
+    int argc;
+    char **argv;
+} params_t;
+
+static params_t params = {"minishell", 0, NULL};
+static int last_status;  // $?
+
+void params_set(const char *name, int argc, char **argv) {
+    params.name = name;
+    params.argc = argc;
+    params.argv = argv;
+}
+
+static bool name_char(char c, bool first) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (!first && c >= '0' && c <= '9');
+}
+
+// $NAME: the environment variable, "" if unset
+static const char *env_value(const char *name, size_t len) {
+    char buf[256];
+    if (len >= sizeof(buf))
+        return "";
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    const char *v = getenv(buf);
+    return v ? v : "";
+}
+
+void params_status(int status) {
+    last_status = status;
+}
+
+// The value of the parameter at *ps (just after a '$'), advancing past
+// it; NULL if it is not one. $@ and $* return "" with *all set.
+static const char *param_value(const char **ps, char *num, size_t numsize, bool *all) {
+    const char *s = *ps;
+    long n;
+    *all = false;
+    if (*s == '#' || *s == '?') {
+        snprintf(num, numsize, "%d", *s == '#' ? params.argc : last_status);
+        *ps = s + 1;
+        return num;
+    }
+    if (*s == '@' || *s == '*') {
+        *all = true;
+        *ps = s + 1;
+        return "";
+    }
+    const char *e = s + (*s == '{');
+    if (name_char(*e, true)) {
+        const char *name = e;
+        while (name_char(*e, false))
+            e++;
+        if (*s == '{' && *e++ != '}')
+            return NULL;
+        *ps = e;
+        return env_value(name, e - name - (*s == '{'));
+    }
+    if (*s >= '0' && *s <= '9') {
+        n = *s - '0';
+        *ps = s + 1;
+    } else if (*s == '{' && s[1] >= '0' && s[1] <= '9') {
+        char *end;
+        n = strtol(s + 1, &end, 10);
+        if (*end != '}')
+            return NULL;
+        *ps = end + 1;
+    } else {
+        return NULL;
+    }
+    if (n == 0)
+        return params.name;
+    return n <= params.argc ? params.argv[n - 1] : "";
+}
+
+// Substitutes the parameters in w into out (if not NULL); returns the
+// length of the result.
+static size_t subst(const char *w, char *out) {
+    size_t len = 0;
+    char num[16];
+    while (*w) {
+        const char *s = w + 1;
+        bool all;
+        const char *v = *w == '$' ? param_value(&s, num, sizeof(num), &all) : NULL;
+        if (!v) {
+            if (out)
+                out[len] = *w;
+            len++;
+            w++;
+            continue;
+        }
+        for (int i = all ? 0 : -1; i < (all ? params.argc : 0); i++) {
+            const char *part = i < 0 ? v : params.argv[i];
+            size_t n = strlen(part);
+            if (out) {
+                if (i > 0)
+                    out[len] = ' ';
+                memcpy(out + len + (i > 0), part, n);
+            }
+            len += n + (i > 0);
+        }
+        w = s;
+    }
+    if (out)
+        out[len] = '\0';
+    return len;
+}
+
+static char *subst_dup(arena_t *a, const char *w) {
+    char *out = arena_alloc(a, subst(w, NULL) + 1);
+    subst(w, out);
+    return out;
+}
+
+// Parameter expansion, the first step of expand_words(): the words and
+// file names the parser flagged get a new argv (and redirection list)
+// with $0-$9, ${N}, $#, $?, $@, $* and environment variables ($NAME,
+// ${NAME}) replaced. A word that
+// is just $@ or $* becomes one word per parameter.
+//
+// Quoting is gone by now, so a word that mixes '$1' and $2 has both
+// expanded.
+void params_expand(command_t *cmd) {
+    bool redirs = false;
+    for (redir_t *r = cmd->redirs; r; r = r->next)
+        redirs |= r->params;
+    if (!cmd->word_params && !redirs)
+        return;
+    arena_t *a = cmd->arena;
+
+    if (cmd->word_params) {
+        size_t argc = 0, out = 0;
+        while (cmd->argv[argc])
+            argc++;
+        char **argv = arena_alloc(a, (argc + params.argc + 1) * sizeof(char *));
+        for (size_t i = 0; i < argc; i++) {
+            const char *w = cmd->argv[i];
+            if (!cmd->word_params[i])
+                argv[out++] = cmd->argv[i];
+            else if (strcmp(w, "$@") == 0 || strcmp(w, "$*") == 0)
+                for (int k = 0; k < params.argc; k++)
+                    argv[out++] = params.argv[k];
+            else
+                argv[out++] = subst_dup(a, w);
+        }
+        argv[out] = NULL;
+        cmd->argv = argv;
+        cmd->word_params = NULL;
+    }
+
+    if (redirs) {
+        redir_t *head = NULL;
+        redir_t **tail = &head;
+        for (redir_t *r = cmd->redirs; r; r = r->next) {
+            redir_t *n = arena_alloc(a, sizeof(*n));
+            *n = *r;
+            if (r->params) {
+                n->filename = subst_dup(a, r->filename);
+                n->params = false;
+            }
+            n->next = NULL;
+            *tail = n;
+            tail = &n->next;
+        }
+        cmd->redirs = head;
+    }
+}
+
+// One line of a script: its text, and the commands parsed from it
+// unless it has to be parsed each time it runs.
+typedef struct script_line {
+    const char *text;
+    command_t *cmd;
+} script_line_t;
+
+typedef struct script {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    arena_t arena;         // lines, their text and commands
+    script_line_t *lines;
+    size_t nlines;
+    size_t cap;
+    struct script *next;
+} script_t;
+
+static script_t *scripts;  // parsed scripts kept by script_run()
+static int depth;
+
+static bool same_file(const script_t *s, const struct stat *st) {
+    return s->dev == st->st_dev && s->ino == st->st_ino && s->size == st->st_size &&
+           s->mtime.tv_sec == st->st_mtim.tv_sec && s->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void script_add_line(script_t *s, const char *text, command_t *cmd) {
+    if (s->nlines == s->cap) {
+        size_t ncap = s->cap ? s->cap * 2 : 64;
+        s->lines = arena_grow(&s->arena, s->lines, s->cap * sizeof(*s->lines),
+                              ncap * sizeof(*s->lines));
+        s->cap = ncap;
+    }
+    s->lines[s->nlines++] = (script_line_t){text, cmd};
+}
+
+static void script_free(script_t *s) {
+    arena_free(&s->arena);
+    free(s);
+}
+
+// Runs one line: a copy of its commands, or a fresh parse of its text
+// when aliases apply (or it did not parse). tmp is dropped afterwards.
+static int run_line(shell_state_t *sh, const script_line_t *l, arena_t *tmp) {
+    command_t *cmd;
+    char *expanded = alias_expand(tmp, l->text);
+    if (expanded || !l->cmd)
+        cmd = parse_line(tmp, expanded ? expanded : l->text);
+    else
+        cmd = command_instance(l->cmd, tmp);
+    if (cmd)
+        sh->last_status = execute_commands(sh, cmd);
+    else if (parse_failed())
+        execute_syntax_error(sh);
+    arena_reset(tmp);
+    return sh->last_status;
+}
+
+static bool blank_line(const char *s) {
+    s += strspn(s, " \t\r\n\v\f");
+    return *s == '\0' || *s == '#';
+}
+
+// ---- on-disk cache ----
+
+// A header, then arrays of fixed-size records, then the strings they
+// refer to (by offset) as one NUL-separated blob. Loading is one fread()
+// into the script's arena; the strings are used where they lie, so the
+// only work per command is building its command_t and argv.
+
+typedef struct cache_header {
+    char     magic[4];
+    uint32_t version;
+    uint64_t dev, ino, size;
+    int64_t  mtime_sec, mtime_nsec;
+    uint32_t nlines, ncmds, nwords, nredirs;
+    uint32_t strbytes;
+    uint32_t reserved;
+} cache_header_t;
+
+typedef struct cache_line {
+    uint32_t text;       // string offset
+    uint32_t cmd;        // command index + 1, 0 if parsed at each run
+} cache_line_t;
+
+typedef struct cache_cmd {
+    uint32_t kind;       // command_kind_t
+    uint32_t words;      // index of the first word
+    uint32_t nwords;
+    uint32_t redirs;     // index of the first redirection
+    uint32_t nredirs;
+    uint32_t next_pipe;  // command index + 1, or 0
+    uint32_t next_seq;
+    uint32_t next_if;    // command_next_t
+    uint32_t cond;       // compound commands' parts: command index + 1, or 0
+    uint32_t body;
+    uint32_t else_part;
+    uint32_t background;
+} cache_cmd_t;
+
+typedef struct cache_word {
+    uint32_t str;
+    uint32_t params;
+} cache_word_t;
+
+typedef struct cache_redir {
+    uint32_t type;
+    uint32_t filename;
+    uint32_t params;
+} cache_redir_t;
+
+static bool disk_cache_enabled(void) {
+    const char *env = getenv("MINISHELL_SCRIPT_CACHE");
+    return !env || strcmp(env, "0") != 0;
+}
+
+// The per-user cache directory, $XDG_CACHE_HOME/minishell or
+// ~/.cache/minishell, in a; NULL if there is none. With create, it is
+// made (mode 0700) if missing. Only a directory owned by us that nobody
+// else can write to is used, so no one can plant a cache for our scripts.
+static char *cache_dir(arena_t *a, bool create) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *sub = "minishell";
+    if (!base || base[0] != '/') {
+        base = getenv("HOME");
+        sub = ".cache/minishell";
+    }
+    if (!base || base[0] != '/')
+        return NULL;
+    size_t len = strlen(base) + strlen(sub) + 2;
+    char *dir = arena_alloc(a, len);
+    snprintf(dir, len, "%s/%s", base, sub);
+
+    struct stat st;
+    if (lstat(dir, &st) < 0) {
+        if (!create)
+            return NULL;
+        char *slash = strrchr(dir, '/');
+        *slash = '\0';
+        mkdir(dir, 0700);  // ~/.cache, if that is what is missing
+        *slash = '/';
+        if (mkdir(dir, 0700) < 0 || lstat(dir, &st) < 0)
+            return NULL;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & (S_IWGRP | S_IWOTH)))
+        return NULL;
+    return dir;
+}
+
+// DIR/DEV-INO.mshc for the script with st's device and inode, in a
+static char *cache_path(arena_t *a, const char *dir, uint64_t dev, uint64_t ino) {
+    size_t len = strlen(dir) + 48;
+    char *p = arena_alloc(a, len);
+    snprintf(p, len, "%s/%llx-%llx.mshc", dir, (unsigned long long)dev,
+             (unsigned long long)ino);
+    return p;
+}
+
+// Growable byte buffer for building the cache file
+typedef struct outbuf {
+    char *data;
+    size_t len, cap;
+} outbuf_t;
+
+typedef struct cache_writer {
+    arena_t arena;
+    outbuf_t lines, cmds, words, redirs, strs;
+} cache_writer_t;
+
+// Appends n bytes to b; returns their offset.
+static uint32_t out_put(cache_writer_t *w, outbuf_t *b, const void *p, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t ncap = (b->len + n) * 2;
+        b->data = arena_grow(&w->arena, b->data, b->cap, ncap);
+        b->cap = ncap;
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return (uint32_t)(b->len - n);
+}
+
+static uint32_t put_str(cache_writer_t *w, const char *s) {
+    return out_put(w, &w->strs, s, strlen(s) + 1);
+}
+
+// Appends the commands of cmd and returns the index + 1 of its record.
+// Commands are written in list order, each compound command before its
+// parts, so next_pipe, next_seq and the parts always point forwards.
+static uint32_t put_cmds(cache_writer_t *w, const command_t *cmd) {
+    uint32_t first = 0, prev_seq = 0;
+    for (const command_t *c = cmd; c; c = c->next_seq) {
+        uint32_t prev_pipe = 0;
+        for (const command_t *p = c; p; p = p->next_pipe) {
+            cache_cmd_t rec = {0};
+            rec.words = w->words.len / sizeof(cache_word_t);
+            for (int i = 0; p->argv && p->argv[i]; i++) {
+                cache_word_t cw = {put_str(w, p->argv[i]), p->word_params && p->word_params[i]};
+                out_put(w, &w->words, &cw, sizeof(cw));
+                rec.nwords++;
+            }
+            rec.redirs = w->redirs.len / sizeof(cache_redir_t);
+            for (const redir_t *r = p->redirs; r; r = r->next) {
+                cache_redir_t cr = {r->type, put_str(w, r->filename), r->params};
+                out_put(w, &w->redirs, &cr, sizeof(cr));
+                rec.nredirs++;
+            }
+            rec.kind = p->kind;
+            rec.next_if = p->next_if;
+            rec.background = p->background;
+            uint32_t idx = out_put(w, &w->cmds, &rec, sizeof(rec)) / sizeof(rec) + 1;
+            if (p->kind != CMD_SIMPLE) {
+                uint32_t cond = put_cmds(w, p->cond);
+                uint32_t body = put_cmds(w, p->body);
+                uint32_t else_part = put_cmds(w, p->else_part);
+                cache_cmd_t *r = &((cache_cmd_t *)w->cmds.data)[idx - 1];
+                r->cond = cond;
+                r->body = body;
+                r->else_part = else_part;
+            }
+            cache_cmd_t *recs = (cache_cmd_t *)w->cmds.data;
+            if (!first)
+                first = idx;
+            if (prev_pipe)
+                recs[prev_pipe - 1].next_pipe = idx;
+            else if (prev_seq)
+                recs[prev_seq - 1].next_seq = idx;
+            if (!prev_pipe)
+                prev_seq = idx;
+            prev_pipe = idx;
+        }
+    }
+    return first;
+}
+
+static void cache_write(const script_t *s) {
+    cache_writer_t w = {0};
+    for (size_t i = 0; i < s->nlines; i++) {
+        cache_line_t l = {put_str(&w, s->lines[i].text), 0};
+        if (s->lines[i].cmd)
+            l.cmd = put_cmds(&w, s->lines[i].cmd);
+        out_put(&w, &w.lines, &l, sizeof(l));
+    }
+
+    cache_header_t h = {
+        .magic = CACHE_MAGIC, .version = CACHE_VERSION,
+        .dev = s->dev, .ino = s->ino, .size = s->size,
+        .mtime_sec = s->mtime.tv_sec, .mtime_nsec = s->mtime.tv_nsec,
+        .nlines = s->nlines,
+        .ncmds = w.cmds.len / sizeof(cache_cmd_t),
+        .nwords = w.words.len / sizeof(cache_word_t),
+        .nredirs = w.redirs.len / sizeof(cache_redir_t),
+        .strbytes = w.strs.len,
+    };
+    outbuf_t *parts[] = {&w.lines, &w.cmds, &w.words, &w.redirs, &w.strs};
+
+    // Written under a temporary name and renamed, so readers never see
+    // half a file; no usable cache directory just means no cache.
+    char *dir = cache_dir(&w.arena, true);
+    if (!dir) {
+        arena_free(&w.arena);
+        return;
+    }
+    char *final = cache_path(&w.arena, dir, s->dev, s->ino);
+    size_t len = strlen(final) + 32;
+    char *temp = arena_alloc(&w.arena, len);
+    snprintf(temp, len, "%s.%ld", final, (long)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (fd >= 0 && !f) {
+        close(fd);
+        unlink(temp);
+    }
+    if (f) {
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+        for (size_t i = 0; ok && i < sizeof(parts) / sizeof(parts[0]); i++)
+            ok = !parts[i]->len || fwrite(parts[i]->data, parts[i]->len, 1, f) == 1;
+        if (fclose(f) != 0)
+            ok = false;
+        if (!ok || rename(temp, final) < 0)
+            unlink(temp);
+    }
+    arena_free(&w.arena);
+}
+
+// The script from its cache file, if there is one for exactly this
+// version of the file; NULL otherwise. Anything inconsistent in the
+// file is treated as no cache.
+static script_t *cache_load(const struct stat *st) {
+    script_t *s = xmalloc(sizeof(*s));
+    *s = (script_t){0};
+    char *dir = cache_dir(&s->arena, false);
+    int fd = dir ? open(cache_path(&s->arena, dir, st->st_dev, st->st_ino),
+                        O_RDONLY | O_NOFOLLOW | O_CLOEXEC) : -1;
+    FILE *f = fd >= 0 ? fdopen(fd, "r") : NULL;
+    struct stat cst;
+    if (fd >= 0 && !f)
+        close(fd);
+    if (!f || fstat(fileno(f), &cst) < 0 || !S_ISREG(cst.st_mode) ||
+        (cst.st_uid != geteuid() && cst.st_uid != st->st_uid) ||
+        (cst.st_mode & (S_IWGRP | S_IWOTH)) ||
+        (size_t)cst.st_size < sizeof(cache_header_t))
+        goto fail;
+
+    char *buf = arena_alloc(&s->arena, cst.st_size);
+    if (fread(buf, cst.st_size, 1, f) != 1)
+        goto fail;
+    fclose(f);
+    f = NULL;
+
+    cache_header_t h;
+    memcpy(&h, buf, sizeof(h));
+    if (memcmp(h.magic, CACHE_MAGIC, 4) != 0 || h.version != CACHE_VERSION ||
+        h.dev != (uint64_t)st->st_dev || h.ino != (uint64_t)st->st_ino ||
+        h.size != (uint64_t)st->st_size || h.mtime_sec != st->st_mtim.tv_sec ||
+        h.mtime_nsec != st->st_mtim.tv_nsec)
+        goto fail;
+    uint64_t need = sizeof(h) + (uint64_t)h.nlines * sizeof(cache_line_t) +
+                    (uint64_t)h.ncmds * sizeof(cache_cmd_t) +
+                    (uint64_t)h.nwords * sizeof(cache_word_t) +
+                    (uint64_t)h.nredirs * sizeof(cache_redir_t) + h.strbytes;
+    if (need != (uint64_t)cst.st_size)
+        goto fail;
+
+    cache_line_t *lines = (cache_line_t *)(buf + sizeof(h));
+    cache_cmd_t *cmds = (cache_cmd_t *)(lines + h.nlines);
+    cache_word_t *words = (cache_word_t *)(cmds + h.ncmds);
+    cache_redir_t *redirs = (cache_redir_t *)(words + h.nwords);
+    char *strs = (char *)(redirs + h.nredirs);
+    if (h.strbytes == 0 || strs[h.strbytes - 1] != '\0')
+        goto fail;
+#define STR_OK(off) ((off) < h.strbytes)
+#define FWD_OK(idx) ((idx) == 0 || ((idx) > i + 1 && (idx) <= h.ncmds))
+
+    command_t *out = arena_zalloc(&s->arena, h.ncmds * sizeof(command_t));
+    for (uint32_t i = 0; i < h.ncmds; i++) {
+        cache_cmd_t *c = &cmds[i];
+        command_t *n = &out[i];
+        // Only simple commands and for loops have words; only compound
+        // ones have the parts they need, and all of it comes later
+        bool has_words = c->kind == CMD_SIMPLE || c->kind == CMD_FOR;
+        if (c->kind > CMD_FOR || c->next_if > NEXT_OR || (c->nwords == 0) == has_words ||
+            !FWD_OK(c->cond) || !FWD_OK(c->body) || !FWD_OK(c->else_part) ||
+            (c->kind == CMD_SIMPLE) != !c->body ||
+            (c->kind != CMD_SIMPLE && c->kind != CMD_FOR && !c->cond) ||
+            ((c->kind == CMD_SIMPLE || c->kind == CMD_FOR) && c->cond) ||
+            (c->kind != CMD_IF && c->else_part))
+            goto fail;
+        if (c->words > h.nwords || c->nwords > h.nwords - c->words ||
+            c->redirs > h.nredirs || c->nredirs > h.nredirs - c->redirs ||
+            c->next_pipe > h.ncmds || c->next_seq > h.ncmds ||
+            (c->next_pipe && c->next_pipe <= i + 1) || (c->next_seq && c->next_seq <= i + 1))
+            goto fail;
+        n->kind = c->kind;
+        n->argv = has_words ? arena_alloc(&s->arena, (c->nwords + 1) * sizeof(char *)) : NULL;
+        for (uint32_t k = 0; k < c->nwords; k++) {
+            cache_word_t *cw = &words[c->words + k];
+            if (!STR_OK(cw->str))
+                goto fail;
+            n->argv[k] = strs + cw->str;
+            if (cw->params) {
+                if (!n->word_params)
+                    n->word_params = arena_zalloc(&s->arena, c->nwords * sizeof(bool));
+                n->word_params[k] = true;
+            }
+        }
+        if (has_words)
+            n->argv[c->nwords] = NULL;
+        redir_t **tail = &n->redirs;
+        for (uint32_t k = 0; k < c->nredirs; k++) {
+            cache_redir_t *cr = &redirs[c->redirs + k];
+            if (!STR_OK(cr->filename) || cr->type > REDIR_APPEND)
+                goto fail;
+            redir_t *r = arena_alloc(&s->arena, sizeof(*r));
+            r->type = cr->type;
+            r->filename = strs + cr->filename;
+            r->params = cr->params;
+            r->next = NULL;
+            *tail = r;
+            tail = &r->next;
+        }
+        n->background = c->background;
+        n->next_pipe = c->next_pipe ? &out[c->next_pipe - 1] : NULL;
+        n->next_seq = c->next_seq ? &out[c->next_seq - 1] : NULL;
+        n->next_if = c->next_if;
+        n->cond = c->cond ? &out[c->cond - 1] : NULL;
+        n->body = c->body ? &out[c->body - 1] : NULL;
+        n->else_part = c->else_part ? &out[c->else_part - 1] : NULL;
+        n->arena = &s->arena;
+    }
+
+    s->lines = arena_alloc(&s->arena, h.nlines * sizeof(*s->lines));
+    for (uint32_t i = 0; i < h.nlines; i++) {
+        if (!STR_OK(lines[i].text) || lines[i].cmd > h.ncmds)
+            goto fail;
+        s->lines[i].text = strs + lines[i].text;
+        s->lines[i].cmd = lines[i].cmd ? &out[lines[i].cmd - 1] : NULL;
+    }
+#undef STR_OK
+#undef FWD_OK
+    s->nlines = s->cap = h.nlines;
+    return s;
+
+fail:
+    if (f)
+        fclose(f);
+    script_free(s);
+    return NULL;
+}
+
+// ---- running scripts ----
+
+static int run_cached(shell_state_t *sh, const script_t *s) {
+    arena_t tmp = {0};
+    for (size_t i = 0; i < s->nlines && sh->running; i++)
+        run_line(sh, &s->lines[i], &tmp);
+    arena_free(&tmp);
+    return sh->last_status;
+}
+
+// Whether text, an unfinished command that just got line added, may be
+// complete now: a compound command ends with fi or done, and a trailing
+// | or && needs only one more line. Saves parsing a long loop body
+// again at every line of it.
+static bool may_complete(const char *text, size_t prev_len, const char *line) {
+    while (prev_len > 0 && strchr(" \t\r", text[prev_len - 1]))
+        prev_len--;
+    return strstr(line, "fi") || strstr(line, "done") ||
+           (prev_len > 0 && strchr("|&", text[prev_len - 1]));
+}
+
+// Reads, parses and runs the script a command at a time: a line, or the
+// lines up to the end of a compound command. If it gets to the end of
+// the file, the parsed script is kept in memory and on disk.
+static int run_streaming(shell_state_t *sh, FILE *f, const char *path, const struct stat *st) {
+    script_t *s = xmalloc(sizeof(*s));
+    *s = (script_t){0};
+    s->dev = st->st_dev;
+    s->ino = st->st_ino;
+    s->size = st->st_size;
+    s->mtime = st->st_mtim;
+
+    arena_t tmp = {0};
+    arena_t more = {0};  // the unfinished command's text
+    char *pending = NULL;
+    size_t plen = 0;
+    char *line = NULL;
+    size_t cap = 0;
+    while (sh->running) {
+        ssize_t n = getline(&line, &cap, f);
+        bool eof = n < 0;
+        if (eof && !pending)
+            break;
+        if (!eof && n > 0 && line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (!eof && !pending && blank_line(line))
+            continue;
+        if (pending && !eof) {
+            pending = arena_grow(&more, pending, plen + 1, plen + n + 2);
+            pending[plen] = '\n';
+            memcpy(pending + plen + 1, line, n + 1);
+            bool retry = may_complete(pending, plen, line);
+            plen += n + 1;
+            if (!retry)
+                continue;
+        }
+
+        // Lines that use an alias, and commands with syntax errors, are
+        // kept as text only. A command of several lines is tried in tmp
+        // until it is complete, and only then parsed for keeps.
+        const char *src = pending ? pending : line;
+        char *expanded = alias_expand(&tmp, src);
+        bool incomplete = false;
+        arena_t *a = expanded || pending ? &tmp : &s->arena;
+        command_t *cmd = parse_text(a, expanded ? expanded : src, eof ? NULL : &incomplete);
+        if (incomplete) {
+            if (!pending) {
+                pending = arena_strndup(&more, line, n);
+                plen = n;
+            }
+            arena_reset(&tmp);
+            continue;
+        }
+        bool error = !cmd && parse_failed();
+        char *text = arena_strdup(&s->arena, src);
+        if (pending && !expanded && cmd)
+            cmd = parse_line(&s->arena, text);
+        script_add_line(s, text, expanded ? NULL : cmd);
+        if (cmd)
+            sh->last_status = execute_commands(sh, expanded ? cmd : command_instance(cmd, &tmp));
+        else if (error)
+            execute_syntax_error(sh);
+        arena_reset(&tmp);
+        arena_reset(&more);
+        pending = NULL;
+        if (eof)
+            break;
+    }
+    free(line);
+    arena_free(&tmp);
+    arena_free(&more);
+
+    // Only a regular file read to the end is worth keeping
+    if (ferror(f) || !feof(f) || !S_ISREG(st->st_mode)) {
+        if (ferror(f))
+            perror(path);
+        script_free(s);
+        return sh->last_status;
+    }
+    if (disk_cache_enabled())
+        cache_write(s);
+    s->next = scripts;
+    scripts = s;
+    return sh->last_status;
+}
+
+// Runs the script at path with positional parameters argv[0..argc-1]
+// (if argv is NULL the current ones are kept, as `source FILE` does).
+// Returns the status of its last command, 127 if it cannot be opened.
+int script_run(shell_state_t *sh, const char *path, int argc, char **argv) {
+    if (depth >= SCRIPT_MAX_DEPTH) {
+        fprintf(stderr, "%s: too many nested scripts\n", path);
+        return 1;
+    }
+    FILE *f = fopen(path, "re");
+    struct stat st;
+    if (!f || fstat(fileno(f), &st) < 0) {
+        perror(path);
+        if (f)
+            fclose(f);
+        return 127;
+    }
+
+    params_t saved = params;
+    if (argv)
+        params_set(params.name, argc, argv);
+    depth++;
+
+    script_t *s = S_ISREG(st.st_mode) ? scripts : NULL;
+    while (s && !same_file(s, &st))
+        s = s->next;
+    if (!s && S_ISREG(st.st_mode) && disk_cache_enabled() && (s = cache_load(&st)) != NULL) {
+        s->dev = st.st_dev;
+        s->ino = st.st_ino;
+        s->size = st.st_size;
+        s->mtime = st.st_mtim;
+        s->next = scripts;
+        scripts = s;
+    }
+    int status = s ? run_cached(sh, s) : run_streaming(sh, f, path, &st);
+
+    depth--;
+    params = saved;
+    fclose(f);
+    return status;
+}
+
+// source FILE [ARGS...]: runs FILE in this shell; with ARGS, they are its
+// positional parameters while it runs.
+int script_source(shell_state_t *sh, command_t *cmd) {
+    if (!cmd->argv[1]) {
+        fprintf(stderr, "%s: usage: %s FILE [ARGS...]\n", cmd->argv[0], cmd->argv[0]);
+        return 2;
+    }
+    int argc = 0;
+    while (cmd->argv[2 + argc])
+        argc++;
+    return script_run(sh, cmd->argv[1], argc, argc ? cmd->argv + 2 : NULL);
+}
+
+void script_cleanup(void) {
+    while (scripts) {
+        script_t *next = scripts->next;
+        script_free(scripts);
+        scripts = next;
+    }
+}
@@ -5,14 +5,40 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #include <sys/types.h>
 
 typedef struct shell_state {
     int   last_status;
     bool  running;
+    bool  tail_exec;   // -c mode: the final external command may replace the shell
+    int   pipe_size;   // set pipebuf=SIZE: pipeline pipe capacity, 0 = kernel default
+    int   max_jobs;    // set maxjobs=N: background jobs running at once, 0 = no limit
+    int   loop_depth;  // loops being run
+    int   breaking;    // break/continue N: loops still to leave
+    bool  continuing;  // ...and then continue the next one out
 } shell_state_t;
 
+// arena.c: bump allocation for data that lives as long as one command
+// line (or one queued job), released all at once
+typedef struct arena_block arena_block_t;
+typedef struct arena {
+    arena_block_t *head;    // block being filled
+    arena_block_t *oldest;  // last block of the chain
+    arena_block_t *spare;   // blocks kept by arena_reset()
+    size_t allocs;          // since the last reset
+    size_t blocks;          // ever malloc()ed
+} arena_t;
+void *arena_alloc(arena_t *a, size_t size);
+void *arena_zalloc(arena_t *a, size_t size);
+void *arena_grow(arena_t *a, void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(arena_t *a, const char *s);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+void  arena_reset(arena_t *a);
+void  arena_free(arena_t *a);
+
 // From parser.c
 typedef enum {
     TOK_WORD,
@@ -22,12 +48,22 @@ typedef enum {
     TOK_OUT,
     TOK_APPEND,
     TOK_AMP,
+    TOK_AND,      // &&
+    TOK_OR,       // ||
+    TOK_NEWLINE,
     TOK_END
 } token_type_t;
 
+#define TOKEN_QUOTED  0x1  // word has quotes or backslashes to remove
+#define TOKEN_PARAMS  0x2  // word has $1, $@, $NAME... outside single quotes
+
+// A token is a slice of the line it came from; words are only turned
+// into strings (in place) when the command list is built.
 typedef struct token {
     token_type_t type;
-    char        *value;
+    unsigned     flags;
+    uint32_t     off;
+    uint32_t     len;
 } token_t;
 
 typedef enum {
@@ -39,41 +75,172 @@ typedef enum {
 typedef struct redir {
     redir_type_t type;
     char        *filename;
+    bool         params;    // filename has parameters to expand
     struct redir *next;
 } redir_t;
 
+// What a command node is. Compound commands sit in a list like simple
+// ones; their parts are lists of their own, parsed once and run as
+// often as needed.
+typedef enum {
+    CMD_SIMPLE,
+    CMD_IF,       // if cond; then body; else else_part; fi (elif: a nested CMD_IF)
+    CMD_WHILE,    // while cond; do body; done
+    CMD_UNTIL,    // until cond; do body; done
+    CMD_FOR       // for argv[0] in argv[1...]; do body; done
+} command_kind_t;
+
+// When the pipeline after this one (next_seq) runs
+typedef enum {
+    NEXT_ALWAYS,  // ; & or a newline
+    NEXT_AND,     // &&: if this one succeeded
+    NEXT_OR       // ||: if it failed
+} command_next_t;
+
 typedef struct command {
+    command_kind_t kind;
     char         **argv;       // NULL-terminated args
     redir_t      *redirs;      // linked list of redirections
     bool          background;  // ends with '&'
     struct command *next_pipe; // next command in pipeline
-    struct command *next_seq;  // next command after ';'
+    struct command *next_seq;  // next pipeline in the list
+    command_next_t  next_if;   // on a pipeline's first command: when next_seq runs
+    struct command *cond;      // compound commands' parts
+    struct command *body;
+    struct command *else_part;
+    bool          expanded;    // argv already went through expand_words()
+    bool         *word_params; // per argv word: has parameters to expand; NULL if none
+    arena_t      *arena;       // holds the command, its words and redirections
 } command_t;
 
+typedef struct job job_t;  // jobs.c
+typedef struct cgroup_leaf cgroup_leaf_t;  // cgroup.c
+
 // parser.c
-command_t *parse_line(const char *line);
-void       free_command_list(command_t *cmd);
+ssize_t    tokenize(arena_t *a, const char *line, token_t **out);
+command_t *parse_line(arena_t *a, const char *line);
+command_t *parse_text(arena_t *a, const char *text, bool *incomplete);
+bool       parse_failed(void);
+command_t *command_clone(const command_t *cmd, arena_t *a);
+command_t *command_instance(const command_t *cmd, arena_t *a);
+char      *command_text(const command_t *cmd, bool pipeline);
+
+// scan.c: byte classes and plain-run scanning for the tokenizer
+#define SCAN_END    0x01  // NUL
+#define SCAN_SPACE  0x02
+#define SCAN_QUOTE  0x04  // ' " and backslash
+#define SCAN_OP     0x08  // | & ;
+#define SCAN_REDIR  0x10  // < >
+extern const unsigned char scan_class[256];
+#define scan_is(c, classes) (scan_class[(unsigned char)(c)] & (classes))
+size_t      scan_plain(const char *s);
+bool        scan_select(const char *name);
+const char *scan_impl_name(void);
 
 // builtins.c
 bool is_builtin(const char *name);
 int  run_builtin(shell_state_t *sh, command_t *cmd);
+bool is_stream_builtin(const char *name);
+int  run_stream_builtin(command_t *cmd, FILE *in, FILE *out);
+bool parse_size(const char *s, long *out);
 
 // exec.c
 int execute_commands(shell_state_t *sh, command_t *cmd);
+void execute_syntax_error(shell_state_t *sh);
+int exec_replace(char **argv);
+int setup_redirs(redir_t *r);
+int redirect_stage_fds(redir_t *r, int *in_fd, int *out_fd);
+int pipebuf_set(shell_state_t *sh, long bytes);
+void pipebuf_print(const shell_state_t *sh);
+void exec_start_queued(shell_state_t *sh, command_t *cmd, job_t *job);
+pid_t exec_launch(command_t *cmd, int in_fd, int out_fd, int cgroup_fd);
+
+// envblock.c
+typedef struct env_block {
+    char   *strings;  // "NAME=value\0NAME=value\0..."
+    size_t  len;      // bytes in strings, NULs included
+    size_t *offsets;  // start of each variable within strings
+    int     count;
+} env_block_t;
+const env_block_t *envblock_get(void);
+void envblock_invalidate(void);
+void envblock_print_stats(void);
+void envblock_cleanup(void);
+
+// loader.c
+typedef struct elf_image elf_image_t;
+int loader_run_elf(const char *path, char *const argv[], const env_block_t *env);
+const elf_image_t *loader_prepare(const char *path);
+void loader_report(const char *path);
+int loader_exec_image(const elf_image_t *img, const char *path,
+                      char *const argv[], const env_block_t *env);
+size_t loader_image_size(void);
+void loader_print_stats(void);
+void loader_bench_stack(int iterations);
+void loader_clear_cache(void);
+int  loader_set_policy(const char *name, const char *spec);
+void loader_set_fault_report(bool on);
+struct rusage;
+void loader_report_faults(pid_t pid, const struct rusage *ru);
+void loader_cleanup(void);
 
 // jobs.c
-void jobs_init(void);
-void jobs_add(pid_t pgid, const char *cmdline, bool background);
-void jobs_reap(bool blocking);
-void jobs_print(void);
+// One forked stage of a job
+typedef struct job_proc {
+    pid_t  pid;
+    int    pidfd;     // -1: no pidfd, the event loop polls it
+    int    status;    // like $?: exit code, or 128 + signal
+    bool   done;
+    bool   last;      // the pipeline's last stage
+    job_t *job;
+} job_proc_t;
+
+void   jobs_init(void);
+job_t *job_create(command_t *cmd, bool background);
+int    job_cgroup_fd(job_t *j);
+cgroup_leaf_t *job_cgroup(const job_t *j);
+void   job_add_proc(job_t *j, pid_t pid, bool last);
+bool   job_running(const job_t *j);
+pid_t  job_pgid(const job_t *j);
+int    job_wait(job_t *j);
+int    job_wait_threads(job_t *j, void (*on_interrupt)(void *), void *arg);
+void   job_background(job_t *j);
+void   job_enqueue(job_t *j, shell_state_t *sh, command_t *cmd);
+bool   jobs_slot_free(const shell_state_t *sh);
+bool   jobs_queued(void);
+int    jobs_dispatch(int timeout_ms);
+void   jobs_drain_queue(void);
+void   jobs_proc_exited(job_proc_t *p, int status, const struct rusage *ru);
+bool   jobs_have_notices(void);
+void   jobs_notify(void);
+void   jobs_print(bool long_format, bool usage);
+job_t *jobs_find(const char *spec);
+int    jobs_wait_job(const char *spec);
+int    jobs_wait_next(void);
+int    jobs_wait_all(void);
+void   jobs_cleanup(void);
+
+// events.c
+void events_init(void);
+int  events_fd(void);
+void events_watch(job_proc_t *p);
+void events_unwatch(job_proc_t *p);
+int  events_dispatch(int timeout_ms);
+void events_cleanup(void);
 
 // signals.c
 void signals_init(void);
+void signals_reset(void);
+bool signals_interrupted(void);
+void signals_clear_interrupt(void);
+void signals_interruptible(bool on);
 
 // util.c
 char *xstrdup(const char *s);
 void *xmalloc(size_t sz);
+void close_fds_from(int lowfd);
 char *get_prompt(void);
+void prompt_continuation(bool on);
 
 // history.c
 void history_init(void);
@@ -89,19 +256,81 @@ void alias_set(const char *name, const char *value);
 void alias_unset(const char *name);
 const char *alias_get(const char *name);
 void alias_print(const char *name);
-char *alias_expand(const char *line);
+char *alias_expand(arena_t *a, const char *line);
 void aliases_cleanup(void);
 
 // input.c
 ssize_t read_line_with_history(char **lineptr, size_t *n);
+void input_init(void);
+void input_sync(void);
 void input_cleanup(void);
 
 // completion.c
 int complete_input(const char *line, size_t cursor, char **completion, int *list_pos);
 
 // glob.c
-char **expand_glob_patterns(char **argv);
-void free_glob_expansion(char **argv);
+void expand_words(command_t *cmd);
+
+// pathcache.c
+char *pathcache_lookup(const char *name);
+void pathcache_clear(void);
+void pathcache_new_generation(void);
+void pathcache_print(void);
+void pathcache_cleanup(void);
+
+// fdcopy.c
+int copy_fd(int in_fd, int out_fd);
+
+// parallel.c
+int parallel_run(command_t *cmd);
+
+// timing.c
+typedef struct timing_stage timing_stage_t;
+int  timing_prefix(command_t *c);
+bool timing_active(void);
+timing_stage_t *timing_stage_add(const command_t *c, bool pipeline,
+                                 const char *kind, pid_t pid);
+void timing_stage_start(timing_stage_t *s);
+void timing_stage_stop(timing_stage_t *s, int status);
+void timing_proc_exited(pid_t pid, int status, const struct rusage *ru);
+void timing_end(const command_t *cmd, int status);
+void timing_end_discard(void);
+
+// cgroup.c
+bool  cgroup_enabled(void);
+cgroup_leaf_t *cgroup_leaf_create(void);
+int   cgroup_leaf_fd(const cgroup_leaf_t *leaf);
+void  cgroup_leaf_print(const cgroup_leaf_t *leaf);
+void  cgroup_leaf_destroy(cgroup_leaf_t *leaf);
+void  cgroup_enter(int cgroup_fd);
+pid_t cgroup_fork(int cgroup_fd, bool loader_only);
+int   cgroup_builtin(command_t *cmd);
+void  cgroup_cleanup(void);
+
+// script.c
+void params_set(const char *name, int argc, char **argv);
+void params_status(int status);
+void params_expand(command_t *cmd);
+int  script_run(shell_state_t *sh, const char *path, int argc, char **argv);
+int  script_source(shell_state_t *sh, command_t *cmd);
+void script_cleanup(void);
+
+// test.c
+int  test_builtin(command_t *cmd);
+
+// fuse.c
+bool fuse_eligible(command_t *cmd);
+int  fuse_run(command_t *cmd);
+
+// zygote.c
+pid_t zygote_launch(const char *path, const elf_image_t *image, char *const argv[],
+                    const env_block_t *env, redir_t *redirs, int in_fd, int out_fd,
+                    pid_t pgid, bool background, int cgroup_fd);
+bool zygote_pool_low(void);
+bool zygote_refill_one(void);
+void zygote_set_size(int n);
+void zygote_print_stats(void);
+void zygote_cleanup(void);
 
 #endif // SHELL_H
 
@@ -6,21 +6,54 @@
 #include <string.h>
 #include <unistd.h>
 
+// Set by ^C while the shell itself is running (a loop of builtins, say);
+// loops check it between commands.
+static volatile sig_atomic_t interrupted;
+
 static void sigint_handler(int signo) {
     (void)signo;
+    interrupted = 1;
     write(STDOUT_FILENO, "\n", 1);
 }
 
-void signals_init(void) {
+static void set_sigint(bool restart) {
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = sigint_handler;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
+    sa.sa_flags = restart ? SA_RESTART : 0;
     if (sigaction(SIGINT, &sa, NULL) < 0) {
         perror("sigaction");
     }
+}
+
+void signals_init(void) {
+    set_sigint(true);
     signal(SIGTSTP, SIG_IGN);
+    // Lets the shell hand the terminal back to itself with tcsetpgrp()
+    signal(SIGTTOU, SIG_IGN);
+}
+
+bool signals_interrupted(void) {
+    return interrupted;
+}
+
+void signals_clear_interrupt(void) {
+    interrupted = 0;
+}
+
+// While the shell moves data itself (a fused pipeline), ^C has to end a
+// blocking read() or write() with EINTR rather than restart it.
+void signals_interruptible(bool on) {
+    set_sigint(!on);
+}
+
+// Restores default dispositions in a child before it runs a command.
+void signals_reset(void) {
+    interrupted = 0;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
 }
 
 
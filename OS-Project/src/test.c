@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// test EXPR and [ EXPR ]: conditions for if, while and &&/|| without a
+// fork. Status 0 if EXPR is true, 1 if it is false, 2 if it is malformed.
+//
+// expr    := and { -o and }
+// and     := not { -a not }
+// not     := ! not | primary
+// primary := ( expr ) | STRING BINOP STRING | UNOP STRING | STRING
+//
+// A word is taken as an operator only where one fits, so `[ -n ]` and
+// `[ = = = ]` mean what they do in other shells.
+
+typedef struct test_args {
+    const char *name;  // "test" or "["
+    char      **argv;
+    int         argc;
+    int         pos;
+    bool        error;
+} test_args_t;
+
+static const char *peek(const test_args_t *t, int k) {
+    return t->pos + k < t->argc ? t->argv[t->pos + k] : NULL;
+}
+
+static bool is(const char *s, const char *word) {
+    return s && strcmp(s, word) == 0;
+}
+
+static bool fail(test_args_t *t, const char *what, const char *arg) {
+    if (!t->error) {
+        if (arg)
+            fprintf(stderr, "%s: %s: %s\n", t->name, arg, what);
+        else
+            fprintf(stderr, "%s: %s\n", t->name, what);
+    }
+    t->error = true;
+    return false;
+}
+
+static bool binary_op(const char *s) {
+    static const char *const ops[] = {
+        "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", NULL,
+    };
+    for (int i = 0; ops[i]; i++) {
+        if (strcmp(s, ops[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool unary_op(const char *s) {
+    return s[0] == '-' && s[1] && !s[2] && strchr("nzefdrwxsLhpSbct", s[1]);
+}
+
+static bool integer(test_args_t *t, const char *s, long *n) {
+    char *end;
+    errno = 0;
+    *n = strtol(s, &end, 10);
+    while (*end == ' ' || *end == '\t')
+        end++;
+    if (end == s || *end || errno)
+        return fail(t, "integer expression expected", s);
+    return true;
+}
+
+static bool unary(test_args_t *t, char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'L':
+        case 'h': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        case 't': {
+            long fd;
+            return integer(t, arg, &fd) && fd >= 0 && fd <= 0x7fffffff && isatty((int)fd);
+        }
+    }
+    if (stat(arg, &st) < 0)
+        return false;
+    switch (op) {
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+    }
+    return false;
+}
+
+// a -nt b: a exists and b does not, or a was modified later
+static bool newer(const char *a, const char *b) {
+    struct stat sa, sb;
+    if (stat(a, &sa) < 0)
+        return false;
+    if (stat(b, &sb) < 0)
+        return true;
+    if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+        return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec;
+    return sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec;
+}
+
+static bool binary(test_args_t *t, const char *a, const char *op, const char *b) {
+    if (is(op, "=") || is(op, "=="))
+        return strcmp(a, b) == 0;
+    if (is(op, "!="))
+        return strcmp(a, b) != 0;
+    if (is(op, "-nt"))
+        return newer(a, b);
+    if (is(op, "-ot"))
+        return newer(b, a);
+    long x, y;
+    if (!integer(t, a, &x) || !integer(t, b, &y))
+        return false;
+    switch (op[1] << 8 | op[2]) {
+        case 'e' << 8 | 'q': return x == y;
+        case 'n' << 8 | 'e': return x != y;
+        case 'l' << 8 | 't': return x < y;
+        case 'l' << 8 | 'e': return x <= y;
+        case 'g' << 8 | 't': return x > y;
+        default: return x >= y;  // -ge
+    }
+}
+
+static bool expr_or(test_args_t *t);
+
+static bool primary(test_args_t *t) {
+    const char *a = peek(t, 0), *op = peek(t, 1);
+    if (!a)
+        return fail(t, "argument expected", NULL);
+    if (op && peek(t, 2) && binary_op(op)) {
+        t->pos += 3;
+        return binary(t, a, op, peek(t, -1));
+    }
+    if (is(a, "(") && op) {
+        t->pos++;
+        bool v = expr_or(t);
+        if (!is(peek(t, 0), ")"))
+            return fail(t, "missing `)'", NULL);
+        t->pos++;
+        return v;
+    }
+    if (unary_op(a) && op) {
+        t->pos += 2;
+        return unary(t, a[1], op);
+    }
+    t->pos++;
+    return a[0] != '\0';
+}
+
+static bool negation(test_args_t *t) {
+    // With exactly three arguments left, "! op b" is a comparison with
+    // "!" as its left operand ([ ! = ! ]), as POSIX has it.
+    if (is(peek(t, 0), "!") && peek(t, 1) &&
+        !(t->argc - t->pos == 3 && binary_op(peek(t, 1)))) {
+        t->pos++;
+        return !negation(t);
+    }
+    return primary(t);
+}
+
+static bool expr_and(test_args_t *t) {
+    bool v = negation(t);
+    while (!t->error && is(peek(t, 0), "-a") && peek(t, 1)) {
+        t->pos++;
+        v = negation(t) && v;
+    }
+    return v;
+}
+
+static bool expr_or(test_args_t *t) {
+    bool v = expr_and(t);
+    while (!t->error && is(peek(t, 0), "-o") && peek(t, 1)) {
+        t->pos++;
+        v = expr_and(t) || v;
+    }
+    return v;
+}
+
+int test_builtin(command_t *cmd) {
+    test_args_t t = {cmd->argv[0], cmd->argv + 1, 0, 0, false};
+    while (t.argv[t.argc])
+        t.argc++;
+    if (strcmp(t.name, "[") == 0) {
+        if (t.argc == 0 || strcmp(t.argv[t.argc - 1], "]") != 0) {
+            fail(&t, "missing `]'", NULL);
+            return 2;
+        }
+        t.argc--;
+    }
+    if (t.argc == 0)
+        return 1;
+    bool v = expr_or(&t);
+    if (!t.error && t.pos < t.argc)
+        fail(&t, "unexpected argument", t.argv[t.pos]);
+    return t.error ? 2 : !v;
+}
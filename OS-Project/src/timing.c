@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+// time [-j] [-o FILE] PIPELINE
+//
+// Resource usage of one command line, stage by stage. Every process
+// stage is registered here when it is forked and its rusage is taken
+// from the event loop's waitid()/wait4() when it is reaped, so it covers
+// exactly that process. Stages the shell runs itself (thread stages,
+// builtins, fused pipelines) are measured with getrusage(RUSAGE_THREAD)
+// on the thread that runs them. Their max RSS is not reported: it would
+// be the whole shell's high-water mark. Wall time is CLOCK_MONOTONIC from
+// launch to reap (or return).
+//
+// The report goes to stderr, or is appended to FILE with -o; -j prints it
+// as one JSON object per line instead of a table.
+
+struct timing_stage {
+    char            *command;
+    const char      *kind;      // "process", "thread", "builtin", "fused"
+    pid_t            pid;       // 0 if the shell ran it
+    bool             done;
+    int              status;
+    struct timespec  start, end;
+    struct rusage    ru;
+    struct timing_stage *next;
+};
+
+static struct {
+    bool             active;
+    bool             json;
+    char            *out_path;
+    struct timespec  start;
+    timing_stage_t  *stages;
+    timing_stage_t **tail;
+} timing;
+
+static void timing_begin(bool json, const char *out_path) {
+    timing_end_discard();
+    timing.active = true;
+    timing.json = json;
+    timing.out_path = out_path ? xstrdup(out_path) : NULL;
+    timing.stages = NULL;
+    timing.tail = &timing.stages;
+    clock_gettime(CLOCK_MONOTONIC, &timing.start);
+}
+
+bool timing_active(void) {
+    return timing.active;
+}
+
+// Appends a stage; NULL when nothing is being timed. Stages are never
+// moved, so a thread stage may keep its pointer while others are added.
+timing_stage_t *timing_stage_add(const command_t *c, bool pipeline,
+                                 const char *kind, pid_t pid) {
+    if (!timing.active)
+        return NULL;
+    timing_stage_t *s = xmalloc(sizeof(*s));
+    memset(s, 0, sizeof(*s));
+    s->command = command_text(c, pipeline);
+    s->kind = kind;
+    s->pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    *timing.tail = s;
+    timing.tail = &s->next;
+    return s;
+}
+
+static void rusage_sub(struct rusage *a, const struct rusage *b) {
+    timersub(&a->ru_utime, &b->ru_utime, &a->ru_utime);
+    timersub(&a->ru_stime, &b->ru_stime, &a->ru_stime);
+    a->ru_minflt -= b->ru_minflt;
+    a->ru_majflt -= b->ru_majflt;
+    a->ru_nvcsw -= b->ru_nvcsw;
+    a->ru_nivcsw -= b->ru_nivcsw;
+    // ru_maxrss is a high-water mark, not a counter
+}
+
+// Start and stop a stage the shell runs itself, on the thread running
+// it: RUSAGE_THREAD only counts the calling thread.
+void timing_stage_start(timing_stage_t *s) {
+    if (!s)
+        return;
+    getrusage(RUSAGE_THREAD, &s->ru);
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+}
+
+void timing_stage_stop(timing_stage_t *s, int status) {
+    if (!s)
+        return;
+    struct rusage before = s->ru;
+    clock_gettime(CLOCK_MONOTONIC, &s->end);
+    getrusage(RUSAGE_THREAD, &s->ru);
+    rusage_sub(&s->ru, &before);
+    s->status = status;
+    s->done = true;
+}
+
+// Called by jobs.c for every reaped process.
+void timing_proc_exited(pid_t pid, int status, const struct rusage *ru) {
+    if (!timing.active)
+        return;
+    for (timing_stage_t *s = timing.stages; s; s = s->next) {
+        if (s->pid == pid && !s->done) {
+            clock_gettime(CLOCK_MONOTONIC, &s->end);
+            s->ru = *ru;
+            s->status = status;
+            s->done = true;
+            return;
+        }
+    }
+}
+
+static double seconds(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static double tv_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\')
+            fprintf(f, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(f, "\\u%04x", ch);
+        else
+            fputc(ch, f);
+    }
+    fputc('"', f);
+}
+
+static void report_json(FILE *f, const char *cmdline, int status, double real,
+                        double user, double sys) {
+    fputs("{\"command\":", f);
+    json_string(f, cmdline);
+    fprintf(f, ",\"status\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"stages\":[",
+            status, real, user, sys);
+    int n = 1;
+    for (timing_stage_t *s = timing.stages; s; s = s->next, n++) {
+        fprintf(f, "%s{\"stage\":%d,\"kind\":\"%s\",\"pid\":%d,\"command\":",
+                n > 1 ? "," : "", n, s->kind, (int)s->pid);
+        json_string(f, s->command);
+        fprintf(f, ",\"status\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,",
+                s->status, seconds(&s->start, &s->end),
+                tv_seconds(&s->ru.ru_utime), tv_seconds(&s->ru.ru_stime));
+        if (s->pid)
+            fprintf(f, "\"maxrss_kb\":%ld,", s->ru.ru_maxrss);
+        else
+            fputs("\"maxrss_kb\":null,", f);
+        fprintf(f, "\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}",
+                s->ru.ru_minflt, s->ru.ru_majflt, s->ru.ru_nvcsw, s->ru.ru_nivcsw);
+    }
+    fputs("]}\n", f);
+}
+
+static void report_table(FILE *f, const char *cmdline, int status, double real,
+                         double user, double sys) {
+    fprintf(f, "real %.3fs  user %.3fs  sys %.3fs  status %d  %s\n",
+            real, user, sys, status, cmdline);
+    fprintf(f, "  %-3s %-8s %7s %8s %8s %8s %9s %8s %6s %7s %7s  %s\n",
+            "#", "kind", "pid", "real", "user", "sys", "maxrss", "minflt", "majflt",
+            "vcsw", "ivcsw", "command");
+    int n = 1;
+    for (timing_stage_t *s = timing.stages; s; s = s->next, n++) {
+        char pid[16], rss[24];
+        if (s->pid) {
+            snprintf(pid, sizeof(pid), "%d", (int)s->pid);
+            snprintf(rss, sizeof(rss), "%ldkB", s->ru.ru_maxrss);
+        } else {
+            strcpy(pid, "-");
+            strcpy(rss, "-");
+        }
+        fprintf(f, "  %-3d %-8s %7s %8.3f %8.3f %8.3f %9s %8ld %6ld %7ld %7ld  %s\n",
+                n, s->kind, pid, seconds(&s->start, &s->end),
+                tv_seconds(&s->ru.ru_utime), tv_seconds(&s->ru.ru_stime),
+                rss, s->ru.ru_minflt, s->ru.ru_majflt,
+                s->ru.ru_nvcsw, s->ru.ru_nivcsw, s->command);
+    }
+}
+
+// Prints the report for cmd (the pipeline that was timed) and stops
+// timing.
+void timing_end(const command_t *cmd, int status) {
+    if (!timing.active)
+        return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double real = seconds(&timing.start, &now);
+    double user = 0, sys = 0;
+    for (timing_stage_t *s = timing.stages; s; s = s->next) {
+        if (!s->done)
+            s->end = now;  // e.g. launch failed: never reaped
+        user += tv_seconds(&s->ru.ru_utime);
+        sys += tv_seconds(&s->ru.ru_stime);
+    }
+
+    FILE *f = stderr;
+    if (timing.out_path) {
+        f = fopen(timing.out_path, "a");
+        if (!f) {
+            perror(timing.out_path);
+            f = stderr;
+        }
+    }
+    char *cmdline = command_text(cmd, true);
+    fflush(stdout);
+    if (timing.json)
+        report_json(f, cmdline, status, real, user, sys);
+    else
+        report_table(f, cmdline, status, real, user, sys);
+    free(cmdline);
+    if (f != stderr)
+        fclose(f);
+    else
+        fflush(stderr);
+    timing_end_discard();
+}
+
+// Stops timing without a report.
+void timing_end_discard(void) {
+    timing_stage_t *s = timing.stages;
+    while (s) {
+        timing_stage_t *next = s->next;
+        free(s->command);
+        free(s);
+        s = next;
+    }
+    timing.stages = NULL;
+    timing.tail = &timing.stages;
+    free(timing.out_path);
+    timing.out_path = NULL;
+    timing.active = false;
+}
+
+// If c starts with the "time" prefix, strips it and its options (the
+// words stay in the line's arena) and starts timing. Returns 1 if it did, 0 if c is not timed, -1 (after a
+// message) for a bad prefix.
+int timing_prefix(command_t *c) {
+    char **argv = c->argv;
+    if (!argv[0] || strcmp(argv[0], "time") != 0)
+        return 0;
+    bool json = false;
+    const char *out_path = NULL;
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "-o") == 0 && argv[i + 1]) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "time: %s: invalid option\n", argv[i]);
+            return -1;
+        }
+    }
+    if (!argv[i]) {
+        fprintf(stderr, "time: usage: time [-j] [-o FILE] COMMAND [ARGS...] [| ...]\n");
+        return -1;
+    }
+
+    bool timed = !c->background;
+    if (timed)
+        timing_begin(json, out_path);
+    else
+        fprintf(stderr, "time: background jobs are not timed\n");
+    c->argv = argv + i;  // the array itself may belong to a cached script
+    return timed ? 1 : 0;
+}
@@ -28,12 +28,31 @@ char *xstrdup(const char *s) {
     return d;
 }
 
+// Closes every descriptor from lowfd up. Without execve() nothing is
+// closed on exec for us, so children drop what they must not inherit.
+void close_fds_from(int lowfd) {
+    if (close_range(lowfd, ~0U, 0) == 0)
+        return;
+    long max = sysconf(_SC_OPEN_MAX);
+    for (int fd = lowfd; fd < max; fd++)
+        close(fd);
+}
+
+static bool continuation;  // reading the rest of an unfinished command
+
+// "> " until the command being typed is complete
+void prompt_continuation(bool on) {
+    continuation = on;
+}
+
 char *get_prompt(void) {
     static char buf[512];
     char host[128];
     char cwd[256];
     const char *user = NULL;
 
+    if (continuation)
+        return strcpy(buf, "> ");
     struct passwd *pw = getpwuid(getuid());
     if (pw) user = pw->pw_name;
     if (!user) user = "user";
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Zygote fork-server.
+//
+// The shell keeps a small pool of pre-forked children parked on a
+// SOCK_SEQPACKET socketpair. Launching an external command sends one
+// message with the resolved path, argv, environment and redirections,
+// plus stdin/stdout/stderr and the current directory as SCM_RIGHTS
+// descriptors (and the job's cgroup, if it has one). The message also
+// carries the parent's validated mapping plan (loader_prepare()), so the
+// parked child replays it like a forked one instead of parsing headers
+// against the image cache it inherited when it was parked. fork() is
+// paid ahead of time, off the critical path: the pool is topped up from
+// the event loop when the shell would otherwise sleep (jobs_dispatch(),
+// the line editor), one child per pass.
+
+#define ZYGOTE_MAX      32
+#define ZYGOTE_SOCK_FD  3
+#define ZYGOTE_NFDS     4   // stdin, stdout, stderr, cwd; then the cgroup, if any
+
+typedef struct zygote {
+    pid_t pid;
+    int   fd;   // parent's end of the socketpair
+} zygote_t;
+
+typedef struct zygote_msg {
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t nredirs;
+    int32_t  pgid;
+    uint32_t background;
+    uint32_t cgroup;    // a fifth descriptor follows: the cgroup to join
+    uint32_t image_len; // bytes of the mapping plan, 0 if there is none
+    uint32_t env_len;   // bytes of the packed environment block
+    uint32_t len;       // bytes of payload following the header
+} zygote_msg_t;
+
+// Payload layout: the mapping plan, the environment block verbatim, its
+// offsets, then the NUL-terminated path, argv strings and (type byte, filename) redirections.
+
+static zygote_t pool[ZYGOTE_MAX];
+static int  pool_count = 0;
+static int  pool_size = 0;
+static long hits = 0;
+static long misses = 0;
+
+// ---- child side ----
+
+static const char *unpack_str(const char **p, const char *end) {
+    const char *s = *p;
+    const char *nul = memchr(s, '\0', end - s);
+    if (!nul)
+        return NULL;
+    *p = nul + 1;
+    return s;
+}
+
+__attribute__((noreturn))
+static void zygote_child(void) {
+    // Parked: wait for a launch request. EOF means the pool was shrunk or
+    // the shell went away.
+    ssize_t n = recv(ZYGOTE_SOCK_FD, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (n < (ssize_t)sizeof(zygote_msg_t))
+        _exit(0);
+
+    char *buf = xmalloc(n);
+    char cbuf[CMSG_SPACE(sizeof(int) * (ZYGOTE_NFDS + 1))];
+    struct iovec iov = {.iov_base = buf, .iov_len = n};
+    struct msghdr mh = {0};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+    if (recvmsg(ZYGOTE_SOCK_FD, &mh, MSG_CMSG_CLOEXEC) != n)
+        _exit(127);
+
+    zygote_msg_t hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    int nfds = ZYGOTE_NFDS + (hdr.cgroup ? 1 : 0);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    if (!cm || cm->cmsg_type != SCM_RIGHTS ||
+        cm->cmsg_len != CMSG_LEN(sizeof(int) * nfds))
+        _exit(127);
+    int fds[ZYGOTE_NFDS + 1];
+    memcpy(fds, CMSG_DATA(cm), sizeof(int) * nfds);
+    close(ZYGOTE_SOCK_FD);
+    const char *p = buf + sizeof(hdr);
+    const char *end = p + hdr.len;
+    if (end > buf + n)
+        _exit(127);
+
+    elf_image_t *image = NULL;
+    if (hdr.image_len) {
+        if (hdr.image_len != loader_image_size() || (size_t)(end - p) < hdr.image_len)
+            _exit(127);
+        image = xmalloc(hdr.image_len);
+        memcpy(image, p, hdr.image_len);
+        p += hdr.image_len;
+    }
+
+    size_t offsets_len = hdr.envc * sizeof(size_t);
+    if ((size_t)(end - p) < hdr.env_len + offsets_len)
+        _exit(127);
+    env_block_t env = {
+        .strings = (char *)p,
+        .len = hdr.env_len,
+        .offsets = xmalloc(offsets_len ? offsets_len : 1),
+        .count = hdr.envc,
+    };
+    p += hdr.env_len;
+    memcpy(env.offsets, p, offsets_len);
+    p += offsets_len;
+
+    const char *path = unpack_str(&p, end);
+    char **argv = xmalloc((hdr.argc + 1) * sizeof(char *));
+    redir_t *redirs = NULL;
+    redir_t **tail = &redirs;
+    for (uint32_t i = 0; i < hdr.argc; i++)
+        argv[i] = (char *)unpack_str(&p, end);
+    argv[hdr.argc] = NULL;
+    for (uint32_t i = 0; i < hdr.nredirs; i++) {
+        if (p >= end)
+            _exit(127);
+        redir_t *r = xmalloc(sizeof(*r));
+        r->type = (redir_type_t)*p++;
+        r->filename = (char *)unpack_str(&p, end);
+        r->next = NULL;
+        *tail = r;
+        tail = &r->next;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (dup2(fds[i], i) < 0)
+            _exit(127);
+        close(fds[i]);
+    }
+    if (fchdir(fds[3]) < 0)
+        _exit(127);
+    close(fds[3]);
+    if (hdr.cgroup) {
+        cgroup_enter(fds[4]);
+        close(fds[4]);
+    }
+
+    if (setup_redirs(redirs) < 0)
+        _exit(127);
+
+    setpgid(0, hdr.pgid);
+    if (!hdr.background)
+        tcsetpgrp(STDIN_FILENO, getpid());
+    signals_reset();
+
+    if (image)
+        loader_exec_image(image, path, argv, &env);
+    else
+        loader_run_elf(path, argv, &env);
+    _exit(127);
+}
+
+// ---- parent side ----
+
+static bool zygote_spawn(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("zygote: socketpair");
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("zygote: fork");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Pre-clean: own process group so terminal signals aren't seen
+        // while parked, only the control socket left open.
+        setpgid(0, 0);
+        if (dup2(sv[1], ZYGOTE_SOCK_FD) < 0)
+            _exit(127);
+        close_fds_from(ZYGOTE_SOCK_FD + 1);
+        zygote_child();
+    }
+
+    close(sv[1]);
+    setpgid(pid, pid);
+    pool[pool_count].pid = pid;
+    pool[pool_count].fd = sv[0];
+    pool_count++;
+    return true;
+}
+
+static void zygote_retire(zygote_t *z) {
+    close(z->fd);
+    waitpid(z->pid, NULL, 0);
+}
+
+static void zygote_refill(void) {
+    while (pool_count < pool_size) {
+        if (!zygote_spawn())
+            break;
+    }
+}
+
+bool zygote_pool_low(void) {
+    return pool_count < pool_size;
+}
+
+// Parks one more child if the pool is short. The event loop calls this
+// when it has nothing else to do. Returns false if nothing was started.
+bool zygote_refill_one(void) {
+    return zygote_pool_low() && zygote_spawn();
+}
+
+void zygote_set_size(int n) {
+    if (n < 0)
+        n = 0;
+    if (n > ZYGOTE_MAX)
+        n = ZYGOTE_MAX;
+    pool_size = n;
+    while (pool_count > pool_size)
+        zygote_retire(&pool[--pool_count]);
+    zygote_refill();
+}
+
+static size_t pack_str(char *dst, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (dst)
+        memcpy(dst, s, len);
+    return len;
+}
+
+// Serialises one launch request into a freshly allocated buffer.
+static char *zygote_pack(const char *path, const elf_image_t *image, char *const argv[],
+                         const env_block_t *env, redir_t *redirs, pid_t pgid,
+                         bool background, bool cgroup, size_t *out_len) {
+    zygote_msg_t hdr = {0};
+    size_t offsets_len = env->count * sizeof(size_t);
+    hdr.envc = env->count;
+    hdr.env_len = env->len;
+    hdr.image_len = image ? loader_image_size() : 0;
+    size_t len = hdr.image_len + env->len + offsets_len + pack_str(NULL, path);
+    for (; argv[hdr.argc]; hdr.argc++)
+        len += pack_str(NULL, argv[hdr.argc]);
+    for (redir_t *r = redirs; r; r = r->next, hdr.nredirs++)
+        len += 1 + pack_str(NULL, r->filename);
+    hdr.pgid = pgid;
+    hdr.background = background;
+    hdr.cgroup = cgroup;
+    hdr.len = len;
+
+    char *buf = xmalloc(sizeof(hdr) + len);
+    memcpy(buf, &hdr, sizeof(hdr));
+    char *p = buf + sizeof(hdr);
+    if (image)
+        memcpy(p, image, hdr.image_len);
+    p += hdr.image_len;
+    memcpy(p, env->strings, env->len);
+    p += env->len;
+    memcpy(p, env->offsets, offsets_len);
+    p += offsets_len;
+    p += pack_str(p, path);
+    for (uint32_t i = 0; i < hdr.argc; i++)
+        p += pack_str(p, argv[i]);
+    for (redir_t *r = redirs; r; r = r->next) {
+        *p++ = (char)r->type;
+        p += pack_str(p, r->filename);
+    }
+    *out_len = sizeof(hdr) + len;
+    return buf;
+}
+
+pid_t zygote_launch(const char *path, const elf_image_t *image, char *const argv[],
+                    const env_block_t *env, redir_t *redirs, int in_fd, int out_fd,
+                    pid_t pgid, bool background, int cgroup_fd) {
+    if (pool_size == 0)
+        return -1;
+    if (pool_count == 0) {
+        misses++;
+        return -1;
+    }
+
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd < 0) {
+        misses++;
+        return -1;
+    }
+
+    size_t len;
+    char *buf = zygote_pack(path, image, argv, env, redirs, pgid, background,
+                            cgroup_fd >= 0, &len);
+
+    int fds[ZYGOTE_NFDS + 1] = {in_fd, out_fd, STDERR_FILENO, cwd, cgroup_fd};
+    size_t fds_len = sizeof(int) * (ZYGOTE_NFDS + (cgroup_fd >= 0 ? 1 : 0));
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    memset(cbuf, 0, sizeof(cbuf));
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr mh = {0};
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = CMSG_SPACE(fds_len);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(fds_len);
+    memcpy(CMSG_DATA(cm), fds, fds_len);
+
+    pid_t pid = -1;
+    while (pool_count > 0) {
+        zygote_t z = pool[--pool_count];
+        if (sendmsg(z.fd, &mh, MSG_NOSIGNAL) == (ssize_t)len) {
+            close(z.fd);
+            pid = z.pid;
+            break;
+        }
+        if (errno == EMSGSIZE) {
+            // Too large for one datagram; leave the zygote parked.
+            pool_count++;
+            break;
+        }
+        // The parked child died; drop it and try the next one.
+        zygote_retire(&z);
+    }
+
+    free(buf);
+    close(cwd);
+    if (pid < 0)
+        misses++;
+    else
+        hits++;
+    return pid;
+}
+
+void zygote_print_stats(void) {
+    printf("zygote: pool size %d, parked %d, hits %ld, misses %ld\n",
+           pool_size, pool_count, hits, misses);
+}
+
+void zygote_cleanup(void) {
+    zygote_set_size(0);
+}
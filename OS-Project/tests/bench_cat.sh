@@ -0,0 +1,40 @@
+#!/bin/bash
+# Throughput of the cat builtin for each kind of descriptor pair.
+#
+# Usage: make bench-cat [BENCH_MB=1024]
+#    or: tests/bench_cat.sh ./bin/minishell_noexec [MB]
+#
+# Each case copies a MB-sized file once. One untimed copy runs first so
+# every case starts from the page cache. /bin/cat is timed alongside.
+
+SHELL_BIN=${1:-./bin/minishell_noexec}
+MB=${2:-1024}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/bench_cat.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+SRC=$DIR/src.dat
+head -c $((MB * 1024 * 1024)) /dev/urandom > "$SRC" || exit 1
+cat "$SRC" > "$DIR/out.dat"
+
+run() {
+    local label=$1; shift
+    rm -f "$DIR/out.dat"; sync
+    local t0=$(date +%s%N)
+    "$@"
+    local t1=$(date +%s%N)
+    local ms=$(( (t1 - t0) / 1000000 ))
+    [ $ms -gt 0 ] || ms=1
+    printf '%-34s %7d ms %8d MB/s\n' "$label" $ms $(( MB * 1000 / ms ))
+}
+
+M=$(realpath "$SHELL_BIN") && [ -x "$M" ] || { echo "no shell binary: $SHELL_BIN" >&2; exit 1; }
+cd "$DIR" || exit 1
+echo "cat throughput, $MB MB"
+run "file -> file (copy_file_range)"  "$M" -c 'cat src.dat > out.dat'
+run "  /bin/cat"                       bash -c "/bin/cat src.dat > out.dat"
+run "file -> pipe (sendfile)"          bash -c "'$M' -c 'cat src.dat' | /bin/cat > /dev/null"
+run "  /bin/cat"                       bash -c "/bin/cat src.dat | /bin/cat > /dev/null"
+run "pipe -> pipe (splice)"            bash -c "/bin/cat src.dat | '$M' -c cat | /bin/cat > /dev/null"
+run "  /bin/cat"                       bash -c "/bin/cat src.dat | /bin/cat | /bin/cat > /dev/null"
+run "builtin pipeline cat | cat | cat" "$M" -c 'cat src.dat | cat | cat > out.dat'
+run "pipe -> file (splice)"            bash -c "/bin/cat src.dat | '$M' -c 'cat > out.dat'"
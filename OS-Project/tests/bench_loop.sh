@@ -0,0 +1,64 @@
+#!/bin/bash
+# Loop throughput: iterations per second of for/while loops whose bodies
+# are builtins, which run without forking or parsing anything.
+#
+# Usage: make bench-loop [BENCH_LOOP_DEPTH=6]
+#    or: tests/bench_loop.sh ./bin/minishell_noexec [DEPTH]
+#
+# DEPTH nested `for dN in 0 1 2 3 4 5 6 7 8 9` loops make 10^DEPTH
+# iterations of the innermost body (a million by default). For
+# comparison: the same body written out line by line in a script (parsed
+# once per line, no loop), and a loop whose condition is the external
+# /usr/bin/test, which forks for every iteration.
+
+SHELL_BIN=${1:-./bin/minishell_noexec}
+DEPTH=${2:-6}
+M=$(realpath "$SHELL_BIN") && [ -x "$M" ] || { echo "no shell binary: $SHELL_BIN" >&2; exit 1; }
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/bench_loop.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+export MINISHELL_SCRIPT_CACHE=0
+
+# nested LOOPS BODY: LOOPS nested digit loops around BODY
+nested() {
+    local i open="" close=""
+    for ((i = 1; i <= $1; i++)); do
+        open+="for d$i in 0 1 2 3 4 5 6 7 8 9; do "
+        close+="; done"
+    done
+    echo "$open$2$close"
+}
+
+run() {
+    local label=$1 iters=$2 script=$3
+    local t0 t1 ms
+    t0=$(date +%s%N)
+    "$M" "$script" > /dev/null || { echo "$label: failed" >&2; return; }
+    t1=$(date +%s%N)
+    ms=$(( (t1 - t0) / 1000000 ))
+    [ $ms -gt 0 ] || ms=1
+    printf '%-34s %9d %8d ms %12d iterations/s\n' "$label" "$iters" $ms $(( iters * 1000 / ms ))
+}
+
+iters=$((10 ** DEPTH))
+printf '%-34s %9s %11s %23s\n' "body" "iters" "time" "rate"
+
+nested "$DEPTH" ":" > "$DIR/colon.msh"
+run "for: \`:'" $iters "$DIR/colon.msh"
+
+nested "$DEPTH" "[ \$d$DEPTH = 5 ] || :" > "$DIR/test.msh"
+run "for: \`[ \$d = 5 ] || :'" $iters "$DIR/test.msh"
+
+nested "$DEPTH" "if [ \$d$DEPTH -lt 5 ]; then :; elif test -n x; then :; else false; fi" > "$DIR/if.msh"
+run "for: if [ ]; elif test; else; fi" $iters "$DIR/if.msh"
+
+nested $((DEPTH - 1)) "export W=a; while [ \$W != aaaaaaaaaaa ]; do export W=\${W}a; done" > "$DIR/while.msh"
+run "while [ ] (10 per outer pass)" $iters "$DIR/while.msh"
+
+# The unrolled and forking variants are slow; a smaller count will do
+small=$((iters < 100000 ? iters : 100000))
+for ((i = 0; i < small; i++)); do echo "[ $((i % 10)) = 5 ] || :"; done > "$DIR/unrolled.msh"
+run "unrolled lines: \`[ N = 5 ] || :'" $small "$DIR/unrolled.msh"
+
+few=$((iters < 1000 ? iters : 1000))
+nested 3 "/usr/bin/test \$d3 = 5 || :" > "$DIR/fork.msh"
+run "for: \`/usr/bin/test ...' (forks)" $few "$DIR/fork.msh"
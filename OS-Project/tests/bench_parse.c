@@ -0,0 +1,150 @@
+// Parser benchmark: allocations, latency and throughput per command line.
+//
+// Usage: make bench-parse
+//    or: bin/bench_parse [SECONDS_PER_SIZE]
+//
+// Generates command lines of 10 to 100000 words in two mixes: "mixed"
+// (plain words, quoted and escaped ones, redirections, pipes and `;`)
+// and "paths" (long file paths, as xargs or find | xargs produce), then
+// parses each one repeatedly the way the shell does: alias expansion,
+// parse_line(), word expansion, and dropping the line. Every size runs
+// once per tokenizer scanner the CPU supports (scalar, sse2, avx2; see
+// scan.c). Reports the time per line, throughput, how many objects one
+// line takes from the arena, and how many malloc()/calloc()/realloc()
+// calls it costs once the shell has warmed up. Linked with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so that only the
+// shell's own calls are counted.
+
+#define _GNU_SOURCE
+#include "shell.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long mallocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    mallocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    mallocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    mallocs++;
+    return __real_realloc(p, size);
+}
+
+// A line of about nwords words, in a mix typical of generated scripts.
+static char *make_mixed(int nwords) {
+    static const char *const words[] = {
+        "file_0001.txt", "--verbose", "'single quoted words'", "\"double \\\"quoted\\\"\"",
+        "path/to/some/dir", "back\\ slash", "-o", "value=42", "x",
+    };
+    size_t cap = (size_t)nwords * 32 + 64;
+    char *line = xmalloc(cap);
+    size_t len = (size_t)snprintf(line, cap, "/bin/echo");
+    for (int i = 1; i < nwords; i++) {
+        const char *w = words[i % (sizeof(words) / sizeof(words[0]))];
+        if (i % 97 == 0)
+            w = "| /bin/cat";
+        else if (i % 251 == 0)
+            w = "> /dev/null ; /bin/echo";
+        len += (size_t)snprintf(line + len, cap - len, " %s", w);
+    }
+    return line;
+}
+
+// A line of nwords long paths, like `xargs /bin/ls -l` would build.
+static char *make_paths(int nwords) {
+    static const char *const dirs[] = {
+        "/usr/share/doc", "/home/user/projects/minishell/build/objects",
+        "/var/lib/containers/storage/overlay", "/opt/toolchains/x86_64-linux-gnu/include/c++",
+    };
+    size_t cap = (size_t)nwords * 96 + 64;
+    char *line = xmalloc(cap);
+    size_t len = (size_t)snprintf(line, cap, "/bin/ls");
+    for (int i = 1; i < nwords; i++) {
+        const char *d = dirs[i % (sizeof(dirs) / sizeof(dirs[0]))];
+        len += (size_t)snprintf(line + len, cap - len, " %s/module_%05d/source_file_%d.c",
+                                d, i % 1000, i);
+    }
+    return line;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t arena_allocs;  // by the last parse_once()
+
+static int parse_once(arena_t *a, const char *line) {
+    int words = 0;
+    char *expanded = alias_expand(a, line);
+    command_t *cmd = parse_line(a, expanded ? expanded : line);
+    for (command_t *c = cmd; c; c = c->next_seq) {
+        for (command_t *p = c; p; p = p->next_pipe) {
+            expand_words(p);
+            for (int i = 0; p->argv[i]; i++)
+                words++;
+        }
+    }
+    arena_allocs = a->allocs;
+    arena_reset(a);
+    return words;
+}
+
+int main(int argc, char **argv) {
+    double budget = argc > 1 ? atof(argv[1]) : 0.5;
+    static const int sizes[] = {10, 100, 1000, 10000, 100000};
+    static const struct {
+        const char *name;
+        char *(*make)(int nwords);
+    } mixes[] = {{"mixed", make_mixed}, {"paths", make_paths}};
+    static const char *const scanners[] = {"scalar", "sse2", "avx2"};
+    arena_t arena = {0};
+
+    printf("%-6s %-7s %8s %8s %12s %10s %12s %12s %12s %8s\n", "mix", "scanner",
+           "words", "bytes", "us/line", "MB/s", "Mwords/s", "arena/line", "mallocs/line",
+           "blocks");
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            char *line = mixes[m].make(sizes[s]);
+            size_t bytes = strlen(line);
+
+            for (size_t k = 0; k < sizeof(scanners) / sizeof(scanners[0]); k++) {
+                if (!scan_select(scanners[k]))
+                    continue;  // not built, or not supported by this CPU
+                int words = parse_once(&arena, line);  // warm up
+                unsigned long m0 = mallocs;
+                long iters = 0;
+                double t0 = now(), t1;
+                do {
+                    parse_once(&arena, line);
+                    iters++;
+                    t1 = now();
+                } while (t1 - t0 < budget);
+
+                double per_line = (t1 - t0) / iters;
+                printf("%-6s %-7s %8d %8zu %12.2f %10.1f %12.2f %12zu %12.2f %8zu\n",
+                       mixes[m].name, scanners[k], words, bytes, per_line * 1e6,
+                       bytes / per_line / 1e6, words / per_line / 1e6, arena_allocs,
+                       (double)(mallocs - m0) / iters, arena.blocks);
+            }
+            free(line);
+        }
+    }
+    arena_free(&arena);
+    return 0;
+}
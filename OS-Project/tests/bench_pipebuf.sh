@@ -0,0 +1,32 @@
+#!/bin/bash
+# Pipeline throughput for a range of pipe capacities (set pipebuf=SIZE).
+#
+# Usage: make bench-pipe [BENCH_MB=1024]
+#    or: tests/bench_pipebuf.sh ./bin/minishell_noexec [MB]
+#
+# The same three-stage pipeline of external programs moves a MB-sized
+# file through two pipes once per size. Sizes above
+# /proc/sys/fs/pipe-max-size are capped by the shell, which reports what
+# the kernel actually granted.
+
+SHELL_BIN=${1:-./bin/minishell_noexec}
+MB=${2:-1024}
+M=$(realpath "$SHELL_BIN") && [ -x "$M" ] || { echo "no shell binary: $SHELL_BIN" >&2; exit 1; }
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/bench_pipe.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+SRC=$DIR/src.dat
+head -c $((MB * 1024 * 1024)) /dev/urandom > "$SRC" || exit 1
+cat "$SRC" > /dev/null
+
+PIPELINE="/bin/cat $SRC | /bin/cat | /bin/cat > /dev/null"
+
+echo "pipeline throughput, $MB MB: $PIPELINE"
+for size in default 16K 64K 256K 1M 4M; do
+    t0=$(date +%s%N)
+    granted=$("$M" -c "set pipebuf=$size; $PIPELINE")
+    t1=$(date +%s%N)
+    ms=$(( (t1 - t0) / 1000000 ))
+    [ $ms -gt 0 ] || ms=1
+    printf '%-8s %7d ms %6d MB/s   %s\n' "$size" $ms $(( MB * 1000 / ms )) "$granted"
+done
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Script throughput: commands per second for the ways a script can reach
+# the shell.
+#
+# Usage: make bench-script [BENCH_LINES=10000]
+#    or: tests/bench_script.sh ./bin/minishell_noexec [LINES]
+#
+# Generates a LINES-line script of builtin commands (no forks, so parsing
+# and dispatch dominate) and runs it piped to stdin and as a script
+# file: without the parse cache, on the first run (which parses and
+# writes ~/.cache/minishell/DEV-INO.mshc) and on a run that loads the cache.
+
+SHELL_BIN=${1:-./bin/minishell_noexec}
+LINES=${2:-10000}
+M=$(realpath "$SHELL_BIN") && [ -x "$M" ] || { echo "no shell binary: $SHELL_BIN" >&2; exit 1; }
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/bench_script.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+export XDG_CACHE_HOME=$DIR/cache  # keep the parse cache out of ~/.cache
+
+SCRIPT=$DIR/bench.msh
+for ((i = 0; i < LINES; i += 4)); do
+    echo "echo line $i of \$# args: \$1 \"and a quoted string\" > /dev/null"
+    echo "cd . ; pwd > /dev/null"
+    echo "echo 'single quoted' path/to/file_$i.txt --flag=value >> /dev/null"
+    echo "# a comment line"
+done > "$SCRIPT"
+cmds=$(grep -vc '^#' "$SCRIPT")
+cmds=$((cmds + LINES / 4))  # `cd . ; pwd` is two
+
+run() {
+    local label=$1; shift
+    local t0 t1 ms
+    t0=$(date +%s%N)
+    "$@" > /dev/null || { echo "$label: failed" >&2; return; }
+    t1=$(date +%s%N)
+    ms=$(( (t1 - t0) / 1000000 ))
+    [ $ms -gt 0 ] || ms=1
+    printf '%-24s %7d ms %10d commands/s\n' "$label" $ms $(( cmds * 1000 / ms ))
+}
+
+echo "$LINES-line script, $cmds builtin commands"
+run "stdin" sh -c '"$1" < "$2"' - "$M" "$SCRIPT"
+MINISHELL_SCRIPT_CACHE=0 run "file, no cache" "$M" "$SCRIPT" arg1
+run "file, writing cache" "$M" "$SCRIPT" arg1
+run "file, cached" "$M" "$SCRIPT" arg1
@@ -0,0 +1,46 @@
+// Checks that a static-pie program started by the shell's loader was
+// placed and relocated correctly.
+//
+// Build: gcc -static-pie -O2 -o pie_check pie_check.c
+// Run:   ./pie_check   (inside minishell_noexec)
+// Exits 0 when every check passes.
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <link.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/auxv.h>
+
+extern char __ehdr_start[];  // start of the loaded image, set by the linker
+extern void _start(void);
+
+// Initialised pointers need R_X86_64_RELATIVE relocations in a PIE; if
+// self-relocation didn't run (or ran with the wrong bias) these are off.
+static const char message[] = "relocated";
+static const char *const message_ptr = message;
+static int (*const fn_ptr)(const char *, const char *) = strcmp;
+
+static int check(const char *what, int ok) {
+    printf("%-28s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(void) {
+    int failed = 0;
+    uintptr_t base = (uintptr_t)__ehdr_start;
+    const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)__ehdr_start;
+
+    printf("load base: %#lx\n", (unsigned long)base);
+    failed += check("ET_DYN image", eh->e_type == ET_DYN);
+    failed += check("loaded away from 0", base != 0);
+    failed += check("AT_BASE == 0 (no interp)", getauxval(AT_BASE) == 0);
+    failed += check("AT_ENTRY == &_start", getauxval(AT_ENTRY) == (uintptr_t)_start);
+    failed += check("AT_ENTRY == base + e_entry", getauxval(AT_ENTRY) == base + eh->e_entry);
+    failed += check("AT_PHDR == base + e_phoff", getauxval(AT_PHDR) == base + eh->e_phoff);
+    failed += check("AT_PHNUM", getauxval(AT_PHNUM) == eh->e_phnum);
+    failed += check("data relocations", message_ptr == message);
+    failed += check("function pointer relocation", fn_ptr(message_ptr, "relocated") == 0);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+#!/bin/bash
+# Per-job cgroups against the local cgroup2 filesystem.
+#
+# Usage: make test-cgroup
+#    or: tests/test_cgroup.sh ./bin/minishell_noexec
+#
+# Needs a writable cgroup2 mount (root, or a delegated subtree given as
+# CGROUP_ROOT). Makes a scratch directory there, runs the shell with
+# `cgroup on` pointing at it and checks where jobs land, what `jobs -v`
+# reports and that everything is cleaned up. Limit checks only run for
+# controllers that are available in the scratch directory; the rest are
+# reported as skipped. Without a usable cgroup2 mount the whole test is
+# skipped (status 0).
+
+SHELL_BIN=${1:-./bin/minishell_noexec}
+M=$(realpath "$SHELL_BIN") && [ -x "$M" ] || { echo "no shell binary: $SHELL_BIN" >&2; exit 1; }
+
+ROOT=${CGROUP_ROOT:-$(awk '$3 == "cgroup2" { print $2; exit }' /proc/self/mounts)}
+if [ -z "$ROOT" ] || ! mkdir "$ROOT/msh-test-$$" 2>/dev/null; then
+    echo "SKIP: no writable cgroup2 directory (set CGROUP_ROOT)"
+    exit 0
+fi
+ROOT=$ROOT/msh-test-$$
+trap 'rmdir "$ROOT"/*/* "$ROOT"/* "$ROOT" 2>/dev/null' EXIT
+
+fails=0
+check() {
+    local name=$1; shift
+    if "$@"; then
+        echo "PASS: $name"
+    else
+        echo "FAIL: $name"
+        fails=$((fails + 1))
+    fi
+}
+skip() {
+    echo "SKIP: $1"
+}
+run() {
+    "$M" -c "$1" 2>&1
+}
+
+out=$(run "cgroup on $ROOT; zygote 0; /bin/cat /proc/self/cgroup")
+check "forked job runs in its own leaf" \
+    grep -q "^0::.*/msh-test-$$/minishell-[0-9]*/job-[0-9]*$" <<< "$out"
+
+out=$(run "cgroup on $ROOT; zygote 2; /bin/true; /bin/cat /proc/self/cgroup")
+check "zygote launch joins the leaf" \
+    grep -q "^0::.*/msh-test-$$/minishell-[0-9]*/job-[0-9]*$" <<< "$out"
+
+out=$(run "cgroup on $ROOT; /bin/cat /proc/self/cgroup | /bin/cat")
+check "all stages of a pipeline share one leaf" \
+    [ "$(grep -c "^0::.*/job-1$" <<< "$out")" = 1 ]
+
+out=$(run "cgroup on $ROOT; /bin/sh -c 'i=0; while [ \$i -lt 20000 ]; do i=\$((i+1)); done' & /bin/sleep 2 & /bin/sleep 0.5; jobs -v; wait")
+check "jobs -v reports cpu.stat" grep -q "cgroup .*/job-1: .*cpu [0-9.]*s (user" <<< "$out"
+check "jobs -v counts the job's processes" grep -q "job-2: .*procs 1" <<< "$out"
+
+run "cgroup on $ROOT; /bin/true" > /dev/null
+check "leaves and the shell's directory are removed" \
+    [ -z "$(find "$ROOT" -mindepth 1 -type d)" ]
+
+out=$(run "cgroup on $ROOT/missing; echo still running")
+check "a bad root fails but the shell carries on" grep -q "still running" <<< "$out"
+
+out=$(run "cgroup on $ROOT; cgroup limit memory=1X")
+check "bad limits are rejected" grep -q "bad limit" <<< "$out"
+
+# Limits, where the controllers can be enabled below the scratch directory
+controllers=$(cat "$ROOT/cgroup.controllers")
+if grep -qw pids <<< "$controllers"; then
+    out=$(run "cgroup on $ROOT; cgroup limit pids=1; zygote 0; /bin/sh -c '/bin/true & wait'")
+    check "pids.max stops a job from forking" grep -qi "fork\|resource" <<< "$out"
+else
+    skip "pids limit (pids controller not delegated)"
+fi
+if grep -qw memory <<< "$controllers"; then
+    out=$(run "cgroup on $ROOT; cgroup limit memory=16M; /bin/sleep 1 & jobs -v; wait")
+    check "memory.max is set on new leaves" grep -q "(max 16.0 MB)" <<< "$out"
+else
+    skip "memory limit (memory controller not delegated)"
+fi
+if grep -qw cpu <<< "$controllers"; then
+    out=$(run "cgroup on $ROOT; cgroup limit cpu=50%; /bin/sleep 1 & jobs -v; wait")
+    check "cpu.max is set on new leaves" grep -q "(max 50%)" <<< "$out"
+else
+    skip "cpu limit (cpu controller not delegated)"
+    out=$(run "cgroup on $ROOT; cgroup limit cpu=50%; echo ran")
+    check "limits without controllers only warn" \
+        grep -q "cpu controller not available" <<< "$out"
+fi
+
+[ $fails -eq 0 ] && echo "all cgroup tests passed" || echo "$fails cgroup test(s) failed"
+exit $((fails > 0))
@@ -0,0 +1,73 @@
+// Checks that a program started by the shell's loader gets a usable
+// auxiliary vector, in particular the vDSO.
+//
+// Build: gcc -static -O2 -o vdso_check vdso_check.c
+// Run:   ./vdso_check   (inside minishell_noexec)
+// Exits 0 when every check passes.
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/auxv.h>
+#include <time.h>
+#include <unistd.h>
+
+// Looks NAME up in the vDSO's dynamic symbol table. The kernel maps the
+// whole image, section headers included, so the file offsets are valid
+// relative to AT_SYSINFO_EHDR.
+static void *vdso_sym(const char *name) {
+    const char *base = (const char *)getauxval(AT_SYSINFO_EHDR);
+    if (!base)
+        return NULL;
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)base;
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(base + eh->e_shoff);
+    Elf64_Addr load = 0;
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)(base + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD) {
+            load = ph[i].p_vaddr - ph[i].p_offset;
+            break;
+        }
+    }
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_DYNSYM)
+            continue;
+        const Elf64_Sym *sym = (const Elf64_Sym *)(base + sh[i].sh_offset);
+        const char *str = base + sh[sh[i].sh_link].sh_offset;
+        size_t n = sh[i].sh_size / sizeof(*sym);
+        for (size_t k = 0; k < n; k++) {
+            if (sym[k].st_shndx != SHN_UNDEF && strcmp(str + sym[k].st_name, name) == 0)
+                return (void *)(base + (sym[k].st_value - load));
+        }
+    }
+    return NULL;
+}
+
+static int check(const char *what, int ok) {
+    printf("%-28s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(void) {
+    int failed = 0;
+
+    failed += check("AT_SYSINFO_EHDR (vDSO)", getauxval(AT_SYSINFO_EHDR) != 0);
+    failed += check("AT_PAGESZ", getauxval(AT_PAGESZ) == (unsigned long)sysconf(_SC_PAGESIZE));
+    failed += check("AT_RANDOM", getauxval(AT_RANDOM) != 0);
+    failed += check("AT_HWCAP", getauxval(AT_HWCAP) != 0);
+    failed += check("AT_PHDR", getauxval(AT_PHDR) != 0);
+    failed += check("AT_ENTRY", getauxval(AT_ENTRY) != 0);
+    const char *execfn = (const char *)getauxval(AT_EXECFN);
+    failed += check("AT_EXECFN", execfn && strstr(execfn, "vdso_check") != NULL);
+
+    // The vDSO must be a real image, not just a non-zero auxv entry.
+    int (*vdso_gettime)(clockid_t, struct timespec *) =
+        (int (*)(clockid_t, struct timespec *))vdso_sym("__vdso_clock_gettime");
+    failed += check("__vdso_clock_gettime", vdso_gettime != NULL);
+    struct timespec ts = {0, 0};
+    failed += check("vDSO clock_gettime call",
+                    vdso_gettime && vdso_gettime(CLOCK_MONOTONIC, &ts) == 0 && ts.tv_sec > 0);
+
+    return failed ? 1 : 0;
+}